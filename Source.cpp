@@ -4,11 +4,36 @@
 
 #include <iostream>         // cout, cerr
 #include <cstdlib>			// EXIT_FAILURE
+#include <csignal>			// signal
+#include <chrono>			// steady_clock
+#include <cstring>			// strcmp
+#include <thread>			// render thread
+#include <atomic>			// render thread status
+#include <vector>			// pyramid instances
+#include <cmath>			// sqrt, ceil
+#include <functional>		// benchmark bodies
+#include <iomanip>			// benchmark output
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#undef STB_IMAGE_IMPLEMENTATION		// later headers include stb_image.h for declarations only
 
 #include "shader.h"
+#include "resource_cache.h"
+#include "profiler.h"
+#include "gpu_timer.h"
+#include "headless.h"
+#include "fixed_timestep.h"
+#include "spsc_queue.h"
+#include "render_queue.h"
+#include "gl_state.h"
+#include "ring_buffer.h"
+#include "uniform_blocks.h"
+#include "job_system.h"
+#include "texture_streamer.h"
+#include "texture_array.h"
+#include "cooked_texture.h"
+#include "image_ops.h"
 
 // GLM Inclusions
 #include <glm/glm.hpp>		
@@ -29,10 +54,30 @@ namespace
 	struct GLMesh {
 		GLuint vaos[2];									//Variable for mesh VAO
 		GLuint vbos[2];									//Variable for mesh VBOs
+		GLuint instanceVbo;								//Per-instance transform and tint, attached to vaos[0]
+		GLsizei nInstances;								//Number of pyramids drawn from vaos[0]
 		GLuint nVertices;								//Variable for mesh vertices (unrequired but left for modification convinence)
 		GLuint nIndices;								//Cariable for mesh indices
 	};
 
+	//Structure for one Pyramid Instance (vertex attribute locations 3-6 and 7)
+	struct PyramidInstance {
+		glm::mat4 model;								//Transform applied after the shared pyramid model matrix
+		glm::vec3 tint;									//Multiplies the lit color
+	};
+
+	//Structure for Input Events passed from the main thread to the render thread
+	struct InputEvent {
+		enum Type { CURSOR, SCROLL, KEY, RESIZE } type;
+		double x, y;									//Cursor position, scroll offset or framebuffer size
+		int key, action;								//GLFW key and action for KEY events
+	};
+
+	//Structure for Simulation State (everything the fixed-rate update moves)
+	struct SimulationState {
+		glm::vec3 cameraPos;							//Simulated camera position
+	};
+
 	//Vairables for Main Window, Mesh, Shader Program, TextureID
 	GLFWwindow* window = nullptr;
 	GLMesh mesh;
@@ -43,6 +88,42 @@ namespace
 	GLuint rightLightProgramID;
 	GLuint leftLightProgramID;
 
+	//Framebuffer Size used for Viewport and Projection
+	int frameWidth = WINDOW_WIDTH;
+	int frameHeight = WINDOW_HEIGHT;
+
+	//Headless Mode: EGL context, offscreen target and the last frame read back to memory
+	bool headless = false;
+	int headlessFrames = 100;
+	const char* headlessOutput = nullptr;
+	HeadlessContext headlessContext;
+	OffscreenFramebuffer offscreen;
+	std::vector<unsigned char> framePixels;
+
+	//Resource Cache and the Shaders Render() draws with
+	std::unique_ptr<ResourceCache> resourceCache;
+	ResourceCache::ShaderHandle lightShader;
+	ResourceCache::ShaderHandle pyramidShader;
+
+	//Pyramid Shader Uniform Handles, resolved once in LoadResources()
+	Shader::Uniform<int> materialDiffuse;
+	Shader::Uniform<int> materialSpecular;
+	Shader::Uniform<float> materialShininess;
+
+	//Draw Queue: sorted per frame, plus the per-frame matrices UploadFrameBlocks() writes
+	RenderQueue renderQueue;
+	int brickMaterial = -1;
+	glm::mat4 frameView(1.0f);
+	glm::mat4 frameProjection(1.0f);
+
+	//Per-Frame Dynamic Data: persistently mapped ring, one region per frame in flight
+	RingBuffer frameRing;
+	int framesInFlight = 3;								//--frames-in-flight N
+	const GLsizeiptr RING_BYTES_PER_FRAME = 256 * 1024;
+
+	//Uniform Blocks: camera (with the flashlight direction) goes through frameRing every frame, lights are fixed at startup
+	UniformBuffer<LightsBlock> lightsBuffer;
+
 	//Variables for Camera Positioning
 	glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 3.0f);
 	glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
@@ -58,6 +139,9 @@ namespace
 	//Pyramid Color and Position
 	glm::vec3 pyramidPos(0.0f, 0.0f, 0.0f);
 	glm::vec3 pyramidScale(2.0f, 2.0f, 2.0f);
+	int pyramidCount = 1;								//--pyramids N draws a field of N instances
+	const int MAX_PYRAMIDS = 1000000;
+	const float PYRAMID_SPACING = 1.5f;					//Grid spacing of the field in pyramid model units
 
 	//Light Color and Position
 	glm::vec3 rightLightPos(1.0f, 2.0f, 0.0f);
@@ -72,74 +156,288 @@ namespace
 	float deltaTime = 0.0f;
 	float lastFrame = 0.0f;
 	float speedInput = 1.0f;
+
+	//Fixed Timestep Simulation: input sampled per frame, state stepped at 120 Hz and interpolated for rendering
+	const double SIMULATION_RATE = 120.0;
+	FixedTimestep simulationClock(SIMULATION_RATE);
+	SimulationState previousState;
+	SimulationState currentState;
+	glm::vec3 moveInput(0.0f, 0.0f, 0.0f);				//Forward, Right, Up movement axes from the keyboard
+
+	//Render Thread: main thread only pumps GLFW events into inputQueue, render thread owns the GL context
+	SpscQueue<InputEvent, 1024> inputQueue;
+	bool keyDown[GLFW_KEY_LAST + 1] = {};				//Key state as of the last drained KEY event
+	std::atomic<bool> renderThreadFailed(false);
+
+	//Job System: worker threads for anything that can be split into independent ranges
+	int jobWorkers = -1;								//--workers N, -1 = one per core besides the render thread
+	bool pinWorkers = false;							//--pin puts each worker on its own core
+
+	//Texture Streaming: decode on workers, upload on the render thread within a per-frame budget
+	TextureStreamer textureStreamer;
+	double uploadBudget = 2.0;							//--upload-budget MS
+	int previewScale = 0;								//--preview-scale 2|4|8 shows streamed JPEGs at that fraction of their size first
+
+	//Material maps packed into texture arrays by size and format
+	TextureArrays textureArrays;
+
+	//Offline texture cooking: --cook FILE writes FILE's mip chain beside it as .ctex and exits
+	std::vector<const char*> cookFiles;
+	BlockCompressor::Format cookCompression = BlockCompressor::NONE;		//--compress bc1|bc3|bc4|bc5
+	BlockCompressor::Quality cookQuality = BlockCompressor::HIGH;		//--quality fast|high
+
+	//CPU mip chains for streamed and cooked textures: --mip-filter box|kaiser, --linear, --alpha-cutoff X
+	MipGenerator::Options mipOptions;
+
+	bool benchImageOps = false;							//--bench-image-ops times ImageOps kernels against the scalar routines and exits
+	std::vector<const char*> benchDecodeFiles;			//--bench-decode FILE times stb_image decoding FILE at each SIMD level and on 1, 2, 4 and 8 workers, and exits
+	bool testJobs = false;								//--test-jobs checks job system scheduling cases and exits
 }
 
 /*Defined functions
-Function to initialize Window, Function to Create Texture, Function to Process User Input,
+Function to initialize Window, Function to Process User Input,
 Function to for Cursor Callback, Function for Scroll Callback, Function to resize Window,
 Function to Create Shader Program, Function to destroy Shader Program, Function to Create Mesh, 
-Function to Destroy Mesh, Function to Render Object, Function to Flip Texture Image Vertically*/
+Function to Destroy Mesh, Function to Load Render Resources, Function to Release Render Resources,
+Function to Render Object, Function to Flip Texture Image Vertically, Function to Request a Profiler Dump,
+Function to Dump Profiler Results, Function to Parse Command Line Arguments, Function to Initialize Headless Context,
+Function to Get Time, Function to Step Simulation, Function to Interpolate Simulation State,
+Function for Key Callback, Functions to Queue Input Events, Function to Drain Input Events, Function for Render Thread, Function for Render Loop,
+Function to Set Per-Program Frame Uniforms, Function to Create Pyramid Instances,
+Function to Upload the Camera Block, Function to Build the Lights Block, Function to Cook Textures, Function to Benchmark Image Operations,
+Function to Benchmark Image Decoding, Function to Run stb_image Decode Tasks on the Workers, Function to Test the Job System*/
 
 bool InitializeWindow(int, char* [], GLFWwindow** window);
-unsigned int CreateTexture(const char* filename);
+bool ParseArguments(int argc, char* argv[]);
+bool InitializeHeadless();
+double GetTime();
+void Simulate(float step);
+void InterpolateState(float alpha);
 void ProcessInput(GLFWwindow* window);
 void Cursor_callback(GLFWwindow* window, double xposIn, double yposIn);
 void Scroll_callback(GLFWwindow* window, double xOffset, double yOffset);
+void Key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void QueueCursor(GLFWwindow* window, double xpos, double ypos);
+void QueueScroll(GLFWwindow* window, double xOffset, double yOffset);
+void QueueKey(GLFWwindow* window, int key, int scancode, int action, int mods);
+void QueueResize(GLFWwindow* window, int width, int height);
+void DrainInputEvents();
+void RenderThread();
+bool RenderLoop();
 void WindowResize(GLFWwindow* window, int width, int height);
 bool CreateShaderProgram(const char* vertexShaderSource, const char* fragShaderSource, GLuint& programID);
 void DestroyShaderProgram(GLuint programID);
 void CreateMesh(GLMesh& mesh);
 void DestroyMesh(GLMesh& mesh);
+void CreatePyramidInstances(GLMesh& mesh, int count);
+void LoadResources();
+void ReleaseResources();
 void Render();
+void SetFrameUniforms(Shader& shader);
+void UploadFrameBlocks();
+LightsBlock BuildLights();
+bool CookTextures();
+void BenchmarkImageOps();
+bool BenchmarkDecode();
+void ParallelDecode(void* user, int count, stbi_parallel_task* task, void* taskData);
+bool TestJobSystem();
 void flipImageVertically(unsigned char* image, int width, int height, int channels);
+void ProfilerSignal(int signal);
+void DumpProfile();
 
 
 //MAIN FUNCTION
 
 int main(int argc, char* argv[]) {
 
-	if (!InitializeWindow(argc, argv, &window)) {											//Initialize window and check
+	if (!ParseArguments(argc, argv)) {															//Parse --headless and friends
 		return EXIT_FAILURE;
 	}
 
+	if (testJobs) {																			//Starts and stops the workers itself
+		return TestJobSystem() ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (benchImageOps) {																		//Benchmarks need no window or GL context either
+		BenchmarkImageOps();
+		return EXIT_SUCCESS;
+	}
+
+	if (!benchDecodeFiles.empty()) {															//Starts the workers itself, once per worker count timed
+		bool benchmarked = BenchmarkDecode();
+		return benchmarked ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (!cookFiles.empty()) {																	//Cooking needs no window or GL context
+		JobSystem::instance().init(jobWorkers, pinWorkers);									//Blocks are encoded on the workers
+		stbi_set_parallel_for(ParallelDecode, nullptr);										//Large JPEGs are decoded on them too
+		bool cooked = CookTextures();
+		JobSystem::instance().shutdown();
+		return cooked ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (headless) {
+		if (!InitializeHeadless()) {														//Initialize EGL context and check
+			return EXIT_FAILURE;
+		}
+	}
+	else if (!InitializeWindow(argc, argv, &window)) {										//Initialize window and check
+		return EXIT_FAILURE;
+	}
+
+	JobSystem::instance().init(jobWorkers, pinWorkers);									//Start worker threads
+	stbi_set_parallel_for(ParallelDecode, nullptr);											//Split large JPEG decodes across them
+
+#ifdef SIGUSR1
+	signal(SIGUSR1, ProfilerSignal);														//kill -USR1 dumps the profiler without exiting
+#endif
+#ifdef SIGBREAK
+	signal(SIGBREAK, ProfilerSignal);														//Ctrl+Break dumps the profiler on Windows
+#endif
+
+	if (headless) {
+		//No events to pump: render on this thread
+		if (!RenderLoop()) {
+			JobSystem::instance().shutdown();
+			return EXIT_FAILURE;
+		}
+	}
+	else {
+		//Hand the GL context to the render thread and only pump events here
+		glfwMakeContextCurrent(NULL);
+		std::thread renderThread(RenderThread);
+
+		while (!glfwWindowShouldClose(window)) {
+			glfwWaitEvents();																//Sleep until input arrives; callbacks push into inputQueue
+		}
+
+		renderThread.join();
+		glfwTerminate();
+		if (renderThreadFailed) {
+			JobSystem::instance().shutdown();
+			return EXIT_FAILURE;
+		}
+	}
+
+	JobSystem::instance().shutdown();													//Join worker threads
+
+	exit(EXIT_SUCCESS);													//EXIT
+}
+
+
+void RenderThread() {																		//Function for Render Thread
+
+	glfwMakeContextCurrent(window);															//GL context lives on this thread from here on
+	if (!RenderLoop())
+		renderThreadFailed = true;
+
+	glfwMakeContextCurrent(NULL);
+	glfwSetWindowShouldClose(window, true);													//Stop the event pump
+	glfwPostEmptyEvent();																	//Wake it if it is waiting
+}
+
+bool RenderLoop() {																			//Function for Render Loop
+
 	// glad: load all OpenGL function pointers
 	// ---------------------------------------
-	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+	GLADloadproc loader = headless ? (GLADloadproc)HeadlessContext::getProcAddress : (GLADloadproc)glfwGetProcAddress;
+	if (!gladLoadGLLoader(loader))
 	{
 		std::cout << "Failed to initialize GLAD" << std::endl;
-		return EXIT_FAILURE;
+		return false;
+	}
+
+	if (headless && !offscreen.create(frameWidth, frameHeight)) {							//Create offscreen render target
+		return false;
 	}
 
 	
-	CreateMesh(mesh);																		//Create Mesh
+	if (!frameRing.create(loader, RING_BYTES_PER_FRAME, framesInFlight)) {					//Create per-frame ring buffer
+		std::cout << "Failed to Create Ring Buffer (needs glBufferStorage)" << std::endl;
+		return false;
+	}
+	renderQueue.setRing(&frameRing);
+	lightsBuffer.create(LIGHTS_BLOCK_BINDING, BuildLights());								//Create lights uniform block, never rewritten
 
+	textureStreamer.init(uploadBudget, mipOptions, previewScale);										//Start texture streaming
+
+	CreateMesh(mesh);																		//Create Mesh
+	LoadResources();																		//Compile Shaders and Load Textures once
+	GpuTimer::instance().init();															//Create GPU timer query pool
 
-	glClearColor(0.0f, 0.0f, 0.0f, 0.1f);
 
+	GLState::instance().invalidate();														//Setup above bound objects directly
+	GLState::instance().clearColor(0.0f, 0.0f, 0.0f, 0.1f);
 
 
 	//RENDER LOOP
 
-	while (!glfwWindowShouldClose(window)) {	
+	currentState.cameraPos = cameraPos;													//Simulation starts where the camera is
+	previousState = currentState;
+
+	int frameCount = 0;
+	while (headless ? frameCount < headlessFrames || textureStreamer.busy() : !glfwWindowShouldClose(window)) {	//Headless frames wait for textures
+		GpuTimer::instance().nextFrame();								//Collect GPU times from earlier frames
+		PROFILE_ZONE("Frame");
+		GPU_ZONE("Frame");
+		frameRing.beginFrame();											//Wait until this frame's ring region is free
 
-		float currentFrame = static_cast<float>(glfwGetTime());			//Determine time difference since previous frame
+		float currentFrame = static_cast<float>(GetTime());				//Determine time difference since previous frame
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
-		ProcessInput(window);											//Process User Input
+		if (window)
+			ProcessInput(window);										//Process User Input
 
-		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT);									//Set background color to desired color
+		{
+			PROFILE_ZONE("Simulate");
+			int steps = simulationClock.advance(deltaTime);				//Run whole fixed steps covered by this frame
+			for (int i = 0; i < steps; ++i)
+				Simulate(static_cast<float>(simulationClock.getStep()));
+			InterpolateState(simulationClock.alpha());					//Blend states for rendering
+		}
+
+		{
+			PROFILE_ZONE("Clear");
+			GLState::instance().clearColor(0.0f, 0.0f, 0.0f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT);								//Set background color to desired color
+		}
 
 		
+		textureStreamer.update();										//Upload decoded textures within budget
 		Render();														//Render Object
+		frameRing.endFrame();											//Fence the ring region Render() wrote
+		++frameCount;
+
+		if (headless) {
+			PROFILE_ZONE("ReadPixels");
+			offscreen.readPixels(framePixels);							//Return frame to memory
+		}
+
+		GLState::instance().endFrame();									//Close per-frame issued/elided counters
 
-		glfwPollEvents();												//Check for user input
+		if (Profiler::instance().consumeDumpRequest())					//Dump requested by signal
+			DumpProfile();
 	}
 
 	DestroyMesh(mesh);													//Destroy Mesh
+	textureStreamer.destroy();											//Drop unfinished loads
+	ReleaseResources();													//Release Shaders and Textures
 	DestroyShaderProgram(programID);									//Destroy Shader Program
+	DumpProfile();														//Write profiler results
+	if (!headless)
+		std::cout << "Input events dropped (queue full): " << inputQueue.getRejected() << std::endl;
+	GpuTimer::instance().destroy();										//Delete GPU timer queries
+	frameRing.destroy();												//Unmap and delete ring buffer
+	lightsBuffer.destroy();												//Delete lights uniform block
+
+	if (headless) {
+		if (headlessOutput && !OffscreenFramebuffer::writePPM(headlessOutput, framePixels, frameWidth, frameHeight))
+			std::cout << "Failed to write frame to " << headlessOutput << std::endl;
+		offscreen.destroy();
+		headlessContext.destroy();
+	}
 
-	exit(EXIT_SUCCESS);													//EXIT
+	return true;
 }
 
 
@@ -165,7 +463,7 @@ bool InitializeWindow(int, char* [], GLFWwindow** window) {												//Functio
 #endif
 
 	//Create Window
-	* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "PyramidWindow", NULL, NULL);
+	* window = glfwCreateWindow(frameWidth, frameHeight, "PyramidWindow", NULL, NULL);
 	//Check Window Creation
 	if (window == NULL) {
 		std::cout << "Failed to Create GLFW Window" << std::endl;
@@ -175,9 +473,11 @@ bool InitializeWindow(int, char* [], GLFWwindow** window) {												//Functio
 
 	//Set Window to Current and FramebufferSizeCallback
 	glfwMakeContextCurrent(*window);
-	glfwSetFramebufferSizeCallback(*window, WindowResize);										//Allow user to resize window
-	glfwSetCursorPosCallback(*window, Cursor_callback);											//Allow cursor input
-	glfwSetScrollCallback(*window, Scroll_callback);											//Allow scroll input
+	//Events are queued for the render thread, which dispatches them to the callbacks below
+	glfwSetFramebufferSizeCallback(*window, QueueResize);										//Allow user to resize window
+	glfwSetCursorPosCallback(*window, QueueCursor);												//Allow cursor input
+	glfwSetScrollCallback(*window, QueueScroll);												//Allow scroll input
+	glfwSetKeyCallback(*window, QueueKey);														//Allow keyboard input
 
 	glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);								//Set to recieve mouse input
 
@@ -186,20 +486,207 @@ bool InitializeWindow(int, char* [], GLFWwindow** window) {												//Functio
 
 
 
+bool ParseArguments(int argc, char* argv[]) {													//Function to Parse Command Line Arguments
+
+	//--headless [--size WIDTHxHEIGHT] [--frames N] [--output frame.ppm]
+	//In either mode: --pyramids N, --frames-in-flight N, --workers N, --pin, --upload-budget MS, --preview-scale 2|4|8
+	//In either mode: --mip-filter box|kaiser, --linear (filter colour as data, not sRGB), --alpha-cutoff X
+	//--bench-image-ops only runs the image operation benchmarks and exits
+	//--test-jobs only runs the job system checks and exits
+	//--bench-decode FILE [--bench-decode FILE ...] only times decoding the files and exits
+	//--cook FILE [--cook FILE ...] [--compress bc1|bc3|bc4|bc5] [--quality fast|high] only writes .ctex files and exits
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--headless") == 0)
+			headless = true;
+		else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%dx%d", &frameWidth, &frameHeight) != 2 || frameWidth <= 0 || frameHeight <= 0) {
+				std::cout << "Invalid --size, expected WIDTHxHEIGHT" << std::endl;
+				return false;
+			}
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			headlessFrames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			headlessOutput = argv[++i];
+		else if (strcmp(argv[i], "--pyramids") == 0 && i + 1 < argc) {
+			pyramidCount = atoi(argv[++i]);
+			if (pyramidCount < 1 || pyramidCount > MAX_PYRAMIDS) {
+				std::cout << "Invalid --pyramids, expected 1 to " << MAX_PYRAMIDS << std::endl;
+				return false;
+			}
+		}
+		else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+			jobWorkers = atoi(argv[++i]);
+			if (jobWorkers < 0 || jobWorkers > JobSystem::MAX_WORKERS) {
+				std::cout << "Invalid --workers, expected 0 to " << JobSystem::MAX_WORKERS << std::endl;
+				return false;
+			}
+		}
+		else if (strcmp(argv[i], "--pin") == 0)
+			pinWorkers = true;
+		else if (strcmp(argv[i], "--upload-budget") == 0 && i + 1 < argc)
+			uploadBudget = atof(argv[++i]);
+		else if (strcmp(argv[i], "--preview-scale") == 0 && i + 1 < argc) {
+			previewScale = atoi(argv[++i]);
+			if (previewScale != 2 && previewScale != 4 && previewScale != 8) {
+				std::cout << "Invalid --preview-scale, expected 2, 4 or 8" << std::endl;
+				return false;
+			}
+		}
+		else if (strcmp(argv[i], "--cook") == 0 && i + 1 < argc)
+			cookFiles.push_back(argv[++i]);
+		else if (strcmp(argv[i], "--mip-filter") == 0 && i + 1 < argc) {
+			const char* filter = argv[++i];
+			if (strcmp(filter, "box") == 0)
+				mipOptions.filter = MipGenerator::BOX;
+			else if (strcmp(filter, "kaiser") == 0)
+				mipOptions.filter = MipGenerator::KAISER;
+			else {
+				std::cout << "Invalid --mip-filter, expected box or kaiser" << std::endl;
+				return false;
+			}
+		}
+		else if (strcmp(argv[i], "--bench-image-ops") == 0)
+			benchImageOps = true;
+		else if (strcmp(argv[i], "--test-jobs") == 0)
+			testJobs = true;
+		else if (strcmp(argv[i], "--bench-decode") == 0 && i + 1 < argc)
+			benchDecodeFiles.push_back(argv[++i]);
+		else if (strcmp(argv[i], "--linear") == 0)
+			mipOptions.srgb = false;
+		else if (strcmp(argv[i], "--alpha-cutoff") == 0 && i + 1 < argc)
+			mipOptions.alphaCutoff = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--compress") == 0 && i + 1 < argc) {
+			const char* format = argv[++i];
+			if (strcmp(format, "bc1") == 0)
+				cookCompression = BlockCompressor::BC1;
+			else if (strcmp(format, "bc3") == 0)
+				cookCompression = BlockCompressor::BC3;
+			else if (strcmp(format, "bc4") == 0)
+				cookCompression = BlockCompressor::BC4;
+			else if (strcmp(format, "bc5") == 0)
+				cookCompression = BlockCompressor::BC5;
+			else {
+				std::cout << "Invalid --compress, expected bc1, bc3, bc4 or bc5" << std::endl;
+				return false;
+			}
+		}
+		else if (strcmp(argv[i], "--quality") == 0 && i + 1 < argc) {
+			const char* quality = argv[++i];
+			if (strcmp(quality, "fast") == 0)
+				cookQuality = BlockCompressor::FAST;
+			else if (strcmp(quality, "high") == 0)
+				cookQuality = BlockCompressor::HIGH;
+			else {
+				std::cout << "Invalid --quality, expected fast or high" << std::endl;
+				return false;
+			}
+		}
+		else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+			framesInFlight = atoi(argv[++i]);
+			if (framesInFlight < 1 || framesInFlight > RingBuffer::MAX_FRAMES_IN_FLIGHT) {
+				std::cout << "Invalid --frames-in-flight, expected 1 to " << RingBuffer::MAX_FRAMES_IN_FLIGHT << std::endl;
+				return false;
+			}
+		}
+		else {
+			std::cout << "Unknown argument: " << argv[i] << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool InitializeHeadless() {																		//Function to Initialize Headless Context
+
+	//Same GL version InitializeWindow requests from GLFW
+	if (!headlessContext.create(4, 4)) {
+		std::cout << "Failed to Create Headless Context" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+double GetTime() {																				//Function to Get Time
+
+	//GLFW is never initialized in headless mode, so time comes from the standard clock there
+	if (window)
+		return glfwGetTime();
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 void ProcessInput(GLFWwindow* window) {																			//Function to Process User Input
-	
-	//Constant for camera movement speed
-	float cameraSpeed = static_cast<float>(speedInput * deltaTime);
-	//Camera Movement 
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) cameraPos += cameraSpeed * cameraFront;												//W: Forward
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) cameraPos -= cameraSpeed * cameraFront;												//S: Backward
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;			//A: Left
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;			//D: Right
-	if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) cameraPos += cameraSpeed * cameraUp;													//E: Up
-	if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) cameraPos -= cameraSpeed * cameraUp;													//Q: Down
+	PROFILE_ZONE("ProcessInput");
+
+	DrainInputEvents();																		//Apply everything the main thread queued
+
+	//Movement axes only; Simulate() applies them at the fixed rate
+	moveInput = glm::vec3(0.0f, 0.0f, 0.0f);
+	if (keyDown[GLFW_KEY_W]) moveInput.x += 1.0f;																	//W: Forward
+	if (keyDown[GLFW_KEY_S]) moveInput.x -= 1.0f;																	//S: Backward
+	if (keyDown[GLFW_KEY_A]) moveInput.y -= 1.0f;																	//A: Left
+	if (keyDown[GLFW_KEY_D]) moveInput.y += 1.0f;																	//D: Right
+	if (keyDown[GLFW_KEY_E]) moveInput.z += 1.0f;																	//E: Up
+	if (keyDown[GLFW_KEY_Q]) moveInput.z -= 1.0f;																	//Q: Down
 
 	//IF user presses escape close the window
-	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)glfwSetWindowShouldClose(window, true);				
+	if (keyDown[GLFW_KEY_ESCAPE]) {
+		glfwSetWindowShouldClose(window, true);
+		glfwPostEmptyEvent();																//Wake the event pump so it sees the close
+	}
+}
+
+void DrainInputEvents() {																		//Function to Drain Input Events
+
+	InputEvent event;
+	while (inputQueue.pop(event)) {
+		switch (event.type) {
+		case InputEvent::CURSOR: Cursor_callback(window, event.x, event.y); break;
+		case InputEvent::SCROLL: Scroll_callback(window, event.x, event.y); break;
+		case InputEvent::KEY: Key_callback(window, event.key, 0, event.action, 0); break;
+		case InputEvent::RESIZE: WindowResize(window, (int)event.x, (int)event.y); break;
+		}
+	}
+}
+
+//Main thread side: GLFW callbacks only copy the event into the queue
+void QueueCursor(GLFWwindow* window, double xpos, double ypos) {								//Function to Queue Cursor Event
+	inputQueue.push({ InputEvent::CURSOR, xpos, ypos, 0, 0 });
+}
+
+void QueueScroll(GLFWwindow* window, double xOffset, double yOffset) {							//Function to Queue Scroll Event
+	inputQueue.push({ InputEvent::SCROLL, xOffset, yOffset, 0, 0 });
+}
+
+void QueueKey(GLFWwindow* window, int key, int scancode, int action, int mods) {				//Function to Queue Key Event
+	inputQueue.push({ InputEvent::KEY, 0.0, 0.0, key, action });
+}
+
+void QueueResize(GLFWwindow* window, int width, int height) {									//Function to Queue Resize Event
+	inputQueue.push({ InputEvent::RESIZE, (double)width, (double)height, 0, 0 });
+}
+
+void Key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {			//Function for Key Callback
+	if (key >= 0 && key <= GLFW_KEY_LAST && action != GLFW_REPEAT)
+		keyDown[key] = (action == GLFW_PRESS);
+}
+
+void Simulate(float step) {																		//Function to Step Simulation
+
+	previousState = currentState;
+
+	//Constant for camera movement speed
+	float cameraSpeed = speedInput * step;
+	glm::vec3 cameraRight = glm::normalize(glm::cross(cameraFront, cameraUp));
+	currentState.cameraPos += cameraSpeed * moveInput.x * cameraFront;
+	currentState.cameraPos += cameraSpeed * moveInput.y * cameraRight;
+	currentState.cameraPos += cameraSpeed * moveInput.z * cameraUp;
+}
+
+void InterpolateState(float alpha) {																//Function to Interpolate Simulation State
+
+	cameraPos = glm::mix(previousState.cameraPos, currentState.cameraPos, alpha);
 }
 
 void Cursor_callback(GLFWwindow* window, double xposIn, double yposIn)																		//Function for Cursor Callback
@@ -254,6 +741,8 @@ void Scroll_callback(GLFWwindow* window, double xOffset, double yOffset) {					/
 void WindowResize(GLFWwindow* window, int width, int height) {													//Function to Resize Window
 
 	//Set Window to new Width and Height
+	frameWidth = width;
+	frameHeight = height;
 	glViewport(0, 0, width, height);																			
 }
 
@@ -323,6 +812,8 @@ void CreateMesh(GLMesh& mesh) {													//Function to Create Mesh
 	glVertexAttribPointer(2, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
 	glEnableVertexAttribArray(2);
 
+	CreatePyramidInstances(mesh, pyramidCount);																			//Instance Buffer on the pyramid VAO
+
 
 	glBindVertexArray(mesh.vaos[1]);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[1]);
@@ -334,41 +825,314 @@ void CreateMesh(GLMesh& mesh) {													//Function to Create Mesh
 
 }
 
-unsigned int CreateTexture(const char* filename) {
+bool CookTextures() {																		//Function to Cook Textures
+
+	bool ok = true;
+	for (size_t i = 0; i < cookFiles.size(); ++i) {
+		std::string destination = CookedTexture::pathFor(cookFiles[i]);
+		BlockCompressor::Stats stats;
+		if (CookedTexture::cook(cookFiles[i], destination.c_str(), mipOptions, cookCompression, cookQuality, &stats)) {
+			std::cout << "Cooked " << cookFiles[i] << " -> " << destination << " (" << BlockCompressor::nameOf(cookCompression);
+			if (cookCompression != BlockCompressor::NONE)
+				std::cout << (cookQuality == BlockCompressor::FAST ? " fast" : " high") << ", PSNR " << stats.psnr << " dB, "
+					<< stats.megapixelsPerSecond << " MPix/s on " << BlockCompressor::nameOf(stats.isa);
+			std::cout << ")" << std::endl;
+		}
+		else {
+			std::cout << "Failed to cook " << cookFiles[i] << std::endl;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+void BenchmarkImageOps() {																	//Function to Benchmark Image Operations
+
+	//Synthetic 2048x2048 image; each line times the routine the tree used before ImageOps (or the scalar kernel), then every kernel this CPU runs
+	const int width = 2048, height = 2048, RUNS = 8;
+	const size_t count = (size_t)width * height;
+	std::vector<unsigned char> rgba(count * 4), rgb(count * 3), work(count * 4);
+	std::vector<float> linear(count * 4);
+	unsigned int seed = 12345;
+	for (size_t i = 0; i < rgba.size(); ++i) {
+		seed = seed * 1664525u + 1013904223u;
+		rgba[i] = (unsigned char)(seed >> 24);
+		linear[i] = rgba[i] / 255.0f;
+	}
+	for (size_t i = 0; i < count; ++i)
+		memcpy(&rgb[i * 3], &rgba[i * 4], 3);
+
+	CpuFeatures::get().print(std::cout);
+	std::cout << std::fixed << std::setprecision(2);
+
+	auto measure = [&](const std::function<void()>& prepare, const std::function<void()>& run) {			//Average of RUNS, setup untimed
+		double total = 0.0;
+		for (int i = 0; i < RUNS; ++i) {
+			prepare();
+			auto start = std::chrono::steady_clock::now();
+			run();
+			total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		return total / RUNS;
+	};
+	auto compare = [&](const char* name, const char* legacyName, const std::function<void()>& prepare,
+		const std::function<void()>& legacy, const std::function<void()>& kernel, size_t resultBytes) {
+		ImageOps::setIsa(ImageOps::SCALAR);
+		double baseMs = measure(prepare, legacy ? legacy : kernel);											//Without an old routine the scalar kernel is the baseline
+		std::vector<unsigned char> expected(work.begin(), work.begin() + resultBytes);
+		std::cout << name << ": " << legacyName << " " << baseMs << " ms";
+		for (int isa = legacy ? ImageOps::SCALAR : ImageOps::SSE2; isa <= ImageOps::best(); ++isa) {
+			ImageOps::setIsa((ImageOps::Isa)isa);
+			double ms = measure(prepare, kernel);
+			std::cout << ", " << ImageOps::nameOf((ImageOps::Isa)isa) << " " << ms << " ms (" << baseMs / ms << "x)"
+				<< (memcmp(work.data(), expected.data(), resultBytes) == 0 ? "" : " MISMATCH");
+		}
+		std::cout << std::endl;
+		ImageOps::setIsa(ImageOps::best());
+	};
+
+	auto copyRgba = [&]() { memcpy(work.data(), rgba.data(), rgba.size()); };
+	compare("Flip 2048x2048 RGBA", "byte loop", copyRgba,
+		[&]() {																							//flipImageVertically as it was
+			for (int j = 0; j < height / 2; ++j) {
+				int index1 = j * width * 4, index2 = (height - 1 - j) * width * 4;
+				for (int i = width * 4; i > 0; --i, ++index1, ++index2) {
+					unsigned char tmp = work[index1];
+					work[index1] = work[index2];
+					work[index2] = tmp;
+				}
+			}
+		},
+		[&]() { ImageOps::flipVertical(work.data(), width, height, 4); }, rgba.size());
+
+	unsigned char* input = nullptr;																		//stbi__convert_format takes ownership of its input
+	compare("RGB to RGBA", "stbi__convert_format", [&]() { input = (unsigned char*)malloc(rgb.size()); memcpy(input, rgb.data(), rgb.size()); },
+		[&]() {
+			unsigned char* converted = stbi__convert_format(input, 3, 4, width, height);
+			memcpy(work.data(), converted, rgba.size());												//Copied out for the comparison, so timed against the old routine
+			stbi_image_free(converted);
+		},
+		[&]() { ImageOps::expand(input, work.data(), count, 3, 4); free(input); }, rgba.size());
+
+	const int bgra[4] = { 2, 1, 0, 3 };
+	compare("Swizzle RGBA to BGRA", "scalar", copyRgba, nullptr, [&]() { ImageOps::swizzle(work.data(), count, bgra); }, rgba.size());
+	compare("Premultiply alpha", "scalar", copyRgba, nullptr, [&]() { ImageOps::premultiplyAlpha(work.data(), count); }, rgba.size());
+	compare("Linear to sRGB", "scalar", []() {}, nullptr, [&]() { ImageOps::linearToSrgb(linear.data(), work.data(), linear.size()); }, rgba.size());
+}
+
+bool BenchmarkDecode() {																	//Function to Benchmark Image Decoding
+
+	//Each file is read into memory once, then decoded RUNS times per SIMD level stb_image can use here; every level must match the scalar pixels.
+	//Reduced-size decodes (stbi_load_scaled) are then timed at the best level, then a full decode split over 1, 2, 4 and 8 workers
+	//(just --workers N if given), which must match too. Only JPEGs with restart markers split their entropy decoding
+	const int RUNS = 10;
+	const char* levelNames[] = { "scalar", "SSE2", "SSSE3", "AVX2" };
+	std::vector<int> workerCounts = jobWorkers >= 0 ? std::vector<int>{ jobWorkers } : std::vector<int>{ 1, 2, 4, 8 };
+	stbi_set_simd_limit(STBI_SIMD_AVX2);
+	int best = stbi_simd_level();
+	double totalMs[4] = {}, totalMegapixels = 0.0, totalFullMs = 0.0;
+	std::vector<double> totalParallelMs(workerCounts.size());
+	bool ok = true;
+
+	CpuFeatures::get().print(std::cout);
+	std::cout << std::fixed << std::setprecision(2);
+	for (size_t f = 0; f < benchDecodeFiles.size(); ++f) {
+		FILE* file = fopen(benchDecodeFiles[f], "rb");
+		if (!file) {
+			std::cout << "Failed to open " << benchDecodeFiles[f] << std::endl;
+			ok = false;
+			continue;
+		}
+		std::vector<unsigned char> encoded;
+		unsigned char chunk[65536];
+		for (size_t n; (n = fread(chunk, 1, sizeof(chunk), file)) > 0;)
+			encoded.insert(encoded.end(), chunk, chunk + n);
+		fclose(file);
+
+		std::vector<unsigned char> expected;
+		int width = 0, height = 0, components = 0;
+		double scalarMs = 0.0;
+		std::cout << benchDecodeFiles[f];
+		for (int level = STBI_SIMD_NONE; level <= best; ++level) {
+			stbi_set_simd_limit(level);
+			double ms = 0.0;
+			bool match = true;
+			for (int run = 0; run < RUNS; ++run) {
+				auto start = std::chrono::steady_clock::now();
+				unsigned char* pixels = stbi_load_from_memory(encoded.data(), (int)encoded.size(), &width, &height, &components, 0);
+				ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				if (!pixels) {
+					std::cout << ": " << stbi_failure_reason() << std::endl;
+					stbi_set_simd_limit(STBI_SIMD_AVX2);
+					return false;
+				}
+				size_t bytes = (size_t)width * height * components;
+				if (expected.empty())
+					expected.assign(pixels, pixels + bytes);
+				else if (run == 0)
+					match = bytes == expected.size() && memcmp(pixels, expected.data(), bytes) == 0;
+				stbi_image_free(pixels);
+			}
+			ms /= RUNS;
+			totalMs[level] += ms;
+			if (level == STBI_SIMD_NONE)
+				std::cout << " (" << width << "x" << height << "x" << components << "):";
+			if (level == STBI_SIMD_NONE)
+				scalarMs = ms;
+			std::cout << " " << levelNames[level] << " " << ms << " ms, " << width * (double)height / 1000.0 / ms << " MPix/s";
+			if (level > STBI_SIMD_NONE)
+				std::cout << " (" << scalarMs / ms << "x)";
+			std::cout << (match ? "" : " MISMATCH") << (level < best ? "," : "");
+			ok = ok && match;
+		}
+		std::cout << std::endl << "  scaled, " << levelNames[best] << ":";
+		double fullMs = 0.0;
+		for (int scale = 1; scale <= 8; scale *= 2) {
+			double ms = 0.0;
+			int scaledWidth = 0, scaledHeight = 0, scaledComponents = 0;
+			for (int run = 0; run < RUNS; ++run) {
+				auto start = std::chrono::steady_clock::now();
+				unsigned char* pixels = stbi_load_from_memory_scaled(encoded.data(), (int)encoded.size(), &scaledWidth, &scaledHeight, &scaledComponents, 0, scale);
+				ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				stbi_image_free(pixels);
+			}
+			ms /= RUNS;
+			if (scale == 1)
+				fullMs = ms;
+			std::cout << " 1/" << scale << " (" << scaledWidth << "x" << scaledHeight << ") " << ms << " ms";
+			if (scale > 1)
+				std::cout << " (" << fullMs / ms << "x)";
+			std::cout << (scale < 8 ? "," : "");
+		}
+		std::cout << std::endl << "  parallel, " << levelNames[best] << ":";
+		for (size_t w = 0; w < workerCounts.size(); ++w) {
+			JobSystem::instance().init(workerCounts[w], pinWorkers);
+			double parallelMs = 0.0;
+			bool parallelMatch = true;
+			stbi_set_parallel_for(ParallelDecode, nullptr);
+			for (int run = 0; run < RUNS; ++run) {
+				auto start = std::chrono::steady_clock::now();
+				unsigned char* pixels = stbi_load_from_memory(encoded.data(), (int)encoded.size(), &width, &height, &components, 0);
+				parallelMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				if (run == 0)
+					parallelMatch = pixels && memcmp(pixels, expected.data(), expected.size()) == 0;
+				stbi_image_free(pixels);
+			}
+			stbi_set_parallel_for(NULL, NULL);
+			JobSystem::instance().shutdown();
+			parallelMs /= RUNS;
+			totalParallelMs[w] += parallelMs;
+			std::cout << " " << workerCounts[w] << (workerCounts[w] == 1 ? " worker " : " workers ") << parallelMs << " ms (" << fullMs / parallelMs << "x)"
+				<< (parallelMatch ? "" : " MISMATCH") << (w + 1 < workerCounts.size() ? "," : "");
+			ok = ok && parallelMatch;
+		}
+		std::cout << std::endl;
+		totalFullMs += fullMs;
+		totalMegapixels += width * (double)height / 1e6;
+	}
+	if (benchDecodeFiles.size() > 1) {
+		std::cout << "All files:";
+		for (int level = STBI_SIMD_NONE; level <= best; ++level)
+			std::cout << " " << levelNames[level] << " " << totalMs[level] << " ms, " << totalMegapixels * 1000.0 / totalMs[level] << " MPix/s"
+				<< (level < best ? "," : "");
+		std::cout << std::endl << "  parallel, " << levelNames[best] << ":";
+		for (size_t w = 0; w < workerCounts.size(); ++w)
+			std::cout << " " << workerCounts[w] << (workerCounts[w] == 1 ? " worker " : " workers ") << totalParallelMs[w] << " ms ("
+				<< totalFullMs / totalParallelMs[w] << "x)" << (w + 1 < workerCounts.size() ? "," : "");
+		std::cout << std::endl;
+	}
+	stbi_set_simd_limit(STBI_SIMD_AVX2);
+	return ok;
+}
+
+void ParallelDecode(void*, int count, stbi_parallel_task* task, void* taskData) {			//Function to Run stb_image Decode Tasks on the Workers
+
+	//stb_image hands over independent ranges (restart intervals, output rows); the calling thread helps until all are done
+	JobSystem::instance().parallelFor(0, count, 1, [&](int begin, int end) {
+		task(taskData, begin, end);
+	});
+}
+
+bool TestJobSystem() {																		//Function to Test the Job System
+
+	//A job on the only worker queues A, then B depending on A; B lands on top of the worker's deque. Both must finish on the worker
+	//alone, so this thread only polls and never helps through wait(). Each case is then repeated with more workers
+	struct Case {
+		JobCounter spawned, first, second;
+		std::atomic<int> order{ 0 };
+		int ranA = 0, ranB = 0;
+	};
+	bool ok = true;
+	const int workerCounts[] = { 1, 2, 4 };
+	for (int workers : workerCounts) {
+		JobSystem::instance().init(workers, false);
+		Case test;
+		JobSystem::instance().run([](void* data, int, int) {
+			Case& test = *(Case*)data;
+			JobSystem::instance().run([](void* data, int, int) {
+				Case& test = *(Case*)data;
+				test.ranA = test.order.fetch_add(1) + 1;
+			}, &test, 0, 0, &test.first);
+			JobSystem::instance().run([](void* data, int, int) {
+				Case& test = *(Case*)data;
+				test.ranB = test.order.fetch_add(1) + 1;
+			}, &test, 0, 0, &test.second, &test.first);
+		}, &test, 0, 0, &test.spawned);
+
+		auto start = std::chrono::steady_clock::now();
+		while (!(test.spawned.done() && test.first.done() && test.second.done())
+			&& std::chrono::steady_clock::now() - start < std::chrono::seconds(2))
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		bool finished = test.spawned.done() && test.first.done() && test.second.done();
+		if (!finished)
+			JobSystem::instance().wait(test.second);											//Let the workers drain before shutdown
+		bool passed = finished && test.ranA == 1 && test.ranB == 2;
+		std::cout << "Dependent job on " << workers << (workers == 1 ? " worker: " : " workers: ")
+			<< (passed ? "ok" : finished ? "FAILED (ran out of order)" : "FAILED (not done after 2 s)") << std::endl;
+		ok = ok && passed;
+		JobSystem::instance().shutdown();
+	}
+	return ok;
+}
 
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
+void CreatePyramidInstances(GLMesh& mesh, int count) {															//Function to Create Pyramid Instances
+
+	//Square grid centred on the origin; one instance is the untinted identity so the single pyramid scene is unchanged
+	std::vector<PyramidInstance> instances(count);
+	int side = (int)std::ceil(std::sqrt((double)count));
+	float offset = (side - 1) * 0.5f * PYRAMID_SPACING;
+	JobSystem::instance().parallelFor(0, count, 4096, [&](int begin, int end) {					//Instances are independent: fill ranges on the workers
+		for (int i = begin; i < end; ++i) {
+			PyramidInstance& instance = instances[i];
+			instance.model = glm::translate(glm::vec3((i % side) * PYRAMID_SPACING - offset, 0.0f, (i / side) * PYRAMID_SPACING - offset));
+			instance.tint = glm::vec3(1.0f, 1.0f, 1.0f);
+			if (count > 1) {
+				unsigned int hash = (unsigned int)i * 2654435761u;										//Cheap per-instance variation
+				instance.model = instance.model * glm::rotate(glm::radians((float)(hash % 360u)), glm::vec3(0.0f, 1.0f, 0.0f));
+				instance.tint = glm::vec3(0.6f + 0.4f * ((hash >> 8) & 0xFF) / 255.0f,
+					0.6f + 0.4f * ((hash >> 16) & 0xFF) / 255.0f,
+					0.6f + 0.4f * ((hash >> 24) & 0xFF) / 255.0f);
+			}
+		}
+	});
 
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(filename, &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << filename << std::endl;
-		stbi_image_free(data);
+	glBindVertexArray(mesh.vaos[0]);
+	glGenBuffers(1, &mesh.instanceVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.instanceVbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(PyramidInstance) * instances.size(), instances.data(), GL_STATIC_DRAW);
+
+	//A mat4 attribute takes four vec4 locations; divisor 1 advances them once per instance instead of per vertex
+	GLsizei stride = sizeof(PyramidInstance);
+	for (GLuint column = 0; column < 4; ++column) {
+		glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(glm::vec4) * column));
+		glEnableVertexAttribArray(3 + column);
+		glVertexAttribDivisor(3 + column, 1);
 	}
+	glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, stride, (char*)sizeof(glm::mat4));
+	glEnableVertexAttribArray(7);
+	glVertexAttribDivisor(7, 1);
 
-	return textureID;
+	mesh.nInstances = count;
 }
 
 void DestroyMesh(GLMesh& mesh) {																					//Function to Destroy Mesh
@@ -376,6 +1140,7 @@ void DestroyMesh(GLMesh& mesh) {																					//Function to Destroy Mesh
 	//Delete VAOs and VBOs
 	glDeleteVertexArrays(2, mesh.vaos);
 	glDeleteBuffers(2, mesh.vbos);
+	glDeleteBuffers(1, &mesh.instanceVbo);
 
 }
 
@@ -435,136 +1200,202 @@ void DestroyShaderProgram(GLuint programID) {											//Function to destroy sh
 	glDeleteProgram(programID);
 }
 
-void Render() {																				//Function to Render Object
+void LoadResources() {																		//Function to Load Render Resources
 
-		glEnable(GL_DEPTH_TEST);															//Enable Depth Test for 3D rendering
+	resourceCache.reset(new ResourceCache());
 
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);													//Clear Frame and Z-Buffers
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	lightShader = resourceCache->acquireShader("shaderfiles/6.light_cube.vs", "shaderfiles/6.light_cube.fs");
+	pyramidShader = resourceCache->acquireShader("shaderfiles/6.multiple_lights.vs", "shaderfiles/6.multiple_lights.fs");
 
-																//Bind mesh VAO
+	materialDiffuse = pyramidShader->uniform<int>("material.diffuse");							//Resolve uniform handles once
+	materialSpecular = pyramidShader->uniform<int>("material.specular");
+	materialShininess = pyramidShader->uniform<float>("material.shininess");
 
-	Shader lightShader("shaderfiles/6.light_cube.vs", "shaderfiles/6.light_cube.fs");
-	Shader pyramidShader("shaderfiles/6.multiple_lights.vs", "shaderfiles/6.multiple_lights.fs");
+	if (pyramidShader->blockSize("Camera") != (GLint)sizeof(CameraBlock) ||						//C++ mirrors must match the linked layout
+		pyramidShader->blockSize("Lights") != (GLint)sizeof(LightsBlock)) {
+		std::cout << "Uniform block layout does not match uniform_blocks.h" << std::endl;
+	}
 
+	//Material maps become layers of texture arrays; cooked layers are copied in now, the streamer fills the rest in the background
+	PROFILE_ZONE("Texture Load");
+	TextureArrays::Slot diffuse = textureArrays.add("brickWall.png");
+	TextureArrays::Slot specular = textureArrays.add("brickWall.png");								//Same image: same layer
+	textureArrays.build(textureStreamer);
 
-	unsigned int diffusedMap = CreateTexture("brickWall.png");
-	unsigned int specularMap = CreateTexture("brickWall.png");
+	RenderQueue::Material brick = { GL_TEXTURE_2D_ARRAY,
+		{ textureArrays.texture(diffuse), textureArrays.texture(specular) },						//Diffuse on unit 0, specular on unit 1
+		{ diffuse.layer, specular.layer } };
+	brickMaterial = renderQueue.addMaterial(brick);
+}
 
+void ReleaseResources() {																	//Function to Release Render Resources
 
+	//Drop handles so every entry becomes unreferenced, then free the GL objects
+	lightShader.reset();
+	pyramidShader.reset();
+	resourceCache->evictUnused();
+	textureArrays.print(std::cout);
+	textureArrays.destroy();
 
-	pyramidShader.use();																//Use shader program
-	pyramidShader.setInt("material.diffuse", 0);
-	pyramidShader.setInt("material.specular", 1);
-	pyramidShader.setFloat("material.shininess", 25.0f);
-	pyramidShader.setVec3("viewPos", cameraPos);
+	resourceCache->printStats(std::cout);
+	resourceCache.reset();
+}
 
+void Render() {																				//Function to Render Object
+	PROFILE_ZONE("Render");
 
-	// directional light
-	pyramidShader.setVec3("dirLight.direction", -0.5f, -1.0f, 1.3f);
-	pyramidShader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
-	pyramidShader.setVec3("dirLight.diffuse", 0.4f, 0.4f, 0.4f);
-	pyramidShader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
+	GLState::instance().enable(GL_DEPTH_TEST);												//Enable Depth Test for 3D rendering
 
-	// point light 1
-	pyramidShader.setVec3("pointLights[0].position", rightLightPos);
-	pyramidShader.setVec3("pointLights[0].color", rightLightColor);
-	pyramidShader.setVec3("pointLights[0].ambient", 0.5f, 0.5f, 0.5f);
-	pyramidShader.setVec3("pointLights[0].diffuse", 0.1f, 0.1f, 0.1f);
-	pyramidShader.setVec3("pointLights[0].specular", 0.5f, 0.5f, 0.5f);
-	pyramidShader.setFloat("pointLights[0].constant", 1.0f);
-	pyramidShader.setFloat("pointLights[0].linear", 0.09);
-	pyramidShader.setFloat("pointLights[0].quadratic", 0.032);
-
-	pyramidShader.setVec3("pointLights[1].position", leftLightPos);
-	pyramidShader.setVec3("pointLights[1].color", leftLightColor);
-	pyramidShader.setVec3("pointLights[1].ambient", 0.1f, 0.1f, 0.1f);
-	pyramidShader.setVec3("pointLights[1].diffuse", 0.1f, 0.1f, 0.1f);
-	pyramidShader.setVec3("pointLights[1].specular", 0.1f, 0.1f, 0.1f);
-	pyramidShader.setFloat("pointLights[1].constant", 1.0f);
-	pyramidShader.setFloat("pointLights[1].linear", 0.09);
-	pyramidShader.setFloat("pointLights[1].quadratic", 0.032);
+	GLState::instance().clearColor(0.0f, 0.0f, 0.0f, 1.0f);								//Clear Frame and Z-Buffers
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	// spotLight
-	pyramidShader.setVec3("spotLight.position", rightLightPos);
-	pyramidShader.setVec3("spotLight.direction", cameraFront);
-	pyramidShader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-	pyramidShader.setVec3("spotLight.diffuse", 1.0f, 1.0f, 1.0f);
-	pyramidShader.setVec3("spotLight.specular", 1.0f, 1.0f, 1.0f);
-	pyramidShader.setFloat("spotLight.constant", 1.0f);
-	pyramidShader.setFloat("spotLight.linear", 0.09);
-	pyramidShader.setFloat("spotLight.quadratic", 0.032);
-	pyramidShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-	pyramidShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
-	
-	
+	//View, Pojection
+	frameView = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);					//Set View using LookAt with cameraDirections
 
-	//Model, View Pojection
-	glm::mat4 model = glm::translate(pyramidPos) * glm::scale(pyramidScale);				//Set Model equal to all the transformation
+	frameProjection = glm::perspective(45.0f, (GLfloat)frameWidth / (GLfloat)frameHeight, 0.1f, 100.0f);	//Set Projection using perspective with FOV 45*
 
-	glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);				//Set View using LookAt with cameraDirections
+	{
+		PROFILE_ZONE("Uniform Blocks");
+		UploadFrameBlocks();																//Camera for every program
+	}
 
-	glm::mat4 projection = glm::perspective(45.0f, (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);	//Set Projection using perspective with FOV 45*
+	static const int pyramidPass = GpuTimer::instance().pass("Draw Pyramid");
+	static const int rightLightPass = GpuTimer::instance().pass("Draw RightLight");
+	static const int leftLightPass = GpuTimer::instance().pass("Draw LeftLight");
 
-	pyramidShader.setMat4("model", model);
-	pyramidShader.setMat4("view", view);
-	pyramidShader.setMat4("projection", projection);
+	{
+		PROFILE_ZONE("Submit");
+		glm::mat4 model = glm::translate(pyramidPos) * glm::scale(pyramidScale);				//Set Model equal to all the transformation
+		renderQueue.submit(*pyramidShader, mesh.vaos[0], brickMaterial, model, 0, 18, mesh.nInstances, glm::length(pyramidPos - cameraPos), pyramidPass);
 
+		model = glm::translate(rightLightPos) * glm::scale(rightLightScale);
+		renderQueue.submit(*lightShader, mesh.vaos[1], -1, model, 0, 18, 1, glm::length(rightLightPos - cameraPos), rightLightPass);
 
-	// bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, diffusedMap);
-	// bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, specularMap);
+		model = glm::translate(leftLightPos) * glm::scale(leftLightScale);
+		renderQueue.submit(*lightShader, mesh.vaos[1], -1, model, 0, 18, 1, glm::length(leftLightPos - cameraPos), leftLightPass);
+	}
 
-	
-	glBindVertexArray(mesh.vaos[0]);
-	glDrawArrays(GL_TRIANGLES, 0, 18);
-	
+	{
+		PROFILE_ZONE("Sort");
+		renderQueue.sort();																	//Group draws by program, VAO, material, depth
+	}
+
+	{
+		PROFILE_ZONE("Execute");
+		renderQueue.execute(SetFrameUniforms);												//Draw with only the state changes needed
+	}
 
-	lightShader.use();
-	model = glm::translate(rightLightPos) * glm::scale(rightLightScale);
-	lightShader.setMat4("model", model);
-	lightShader.setMat4("view", view);
-	lightShader.setMat4("projection", projection);
+	{
+		PROFILE_ZONE("SwapBuffers");
+		if (window)
+			glfwSwapBuffers(window);														//Swap Buffers
+	}
+}
 
-	glBindVertexArray(mesh.vaos[1]);
 
-	glDrawArrays(GL_TRIANGLES, 0, 18);
+void SetFrameUniforms(Shader& shader) {															//Function to Set Per-Program Frame Uniforms
+	PROFILE_ZONE("Uniforms");
 
-	lightShader.use();
-	model = glm::translate(leftLightPos) * glm::scale(leftLightScale);
-	lightShader.setMat4("model", model);
-	lightShader.setMat4("view", view);
-	lightShader.setMat4("projection", projection);
+	if (shader.ID != pyramidShader->ID)															//Light cubes only need the blocks
+		return;
 
-	glBindVertexArray(mesh.vaos[1]);
+	shader.set(materialDiffuse, 0);
+	shader.set(materialSpecular, 1);
+	shader.set(materialShininess, 25.0f);
+}
+
+void UploadFrameBlocks() {																		//Function to Upload the Camera Block
+
+	//Camera changes nearly every frame: write it straight into this frame's ring region
+	CameraBlock camera = {};
+	camera.view = frameView;
+	camera.projection = frameProjection;
+	camera.viewPos = cameraPos;
+	camera.spotDirection = cameraFront;
+	GLintptr offset;
+	void* target = frameRing.allocate(sizeof(camera), offset);
+	if (target) {
+		memcpy(target, &camera, sizeof(camera));
+		glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, frameRing.getBuffer(), offset, sizeof(camera));
+	}
+}
 
-	glDrawArrays(GL_TRIANGLES, 0, 18);
+LightsBlock BuildLights() {																		//Function to Build the Lights Block
 
-	
+	LightsBlock lights = {};
+
+	// directional light
+	lights.dirLight.direction = glm::vec3(-0.5f, -1.0f, 1.3f);
+	lights.dirLight.ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+	lights.dirLight.diffuse = glm::vec3(0.4f, 0.4f, 0.4f);
+	lights.dirLight.specular = glm::vec3(0.5f, 0.5f, 0.5f);
 
-																		
+	// point light 1
+	lights.pointLights[0].position = rightLightPos;
+	lights.pointLights[0].color = rightLightColor;
+	lights.pointLights[0].ambient = glm::vec3(0.5f, 0.5f, 0.5f);
+	lights.pointLights[0].diffuse = glm::vec3(0.1f, 0.1f, 0.1f);
+	lights.pointLights[0].specular = glm::vec3(0.5f, 0.5f, 0.5f);
+	lights.pointLights[0].constant = 1.0f;
+	lights.pointLights[0].linear = 0.09f;
+	lights.pointLights[0].quadratic = 0.032f;
+
+	lights.pointLights[1].position = leftLightPos;
+	lights.pointLights[1].color = leftLightColor;
+	lights.pointLights[1].ambient = glm::vec3(0.1f, 0.1f, 0.1f);
+	lights.pointLights[1].diffuse = glm::vec3(0.1f, 0.1f, 0.1f);
+	lights.pointLights[1].specular = glm::vec3(0.1f, 0.1f, 0.1f);
+	lights.pointLights[1].constant = 1.0f;
+	lights.pointLights[1].linear = 0.09f;
+	lights.pointLights[1].quadratic = 0.032f;
 
-	glfwSwapBuffers(window);																//Swap Buffers
+	// spotLight
+	lights.spotLight.position = rightLightPos;
+	lights.spotLight.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+	lights.spotLight.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+	lights.spotLight.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+	lights.spotLight.constant = 1.0f;
+	lights.spotLight.linear = 0.09f;
+	lights.spotLight.quadratic = 0.032f;
+	lights.spotLight.cutOff = glm::cos(glm::radians(12.5f));
+	lights.spotLight.outerCutOff = glm::cos(glm::radians(15.0f));
+	return lights;
 }
 
 
 void flipImageVertically(unsigned char* image, int width, int height, int channels)														//Function to flip texture image vertically
 {
-	for (int j = 0; j < height / 2; ++j)															//For half of the image
-	{
-		int index1 = j * width * channels;															//Set Indices
-		int index2 = (height - 1 - j) * width * channels;
+	ImageOps::flipVertical(image, width, height, channels);										//Swaps whole rows, 16 or 32 bytes at a time
+}
 
-		for (int i = width * channels; i > 0; --i)													//Loop through image horizontally
-		{
-			unsigned char tmp = image[index1];														//temp holder
-			image[index1] = image[index2];															//swap indices
-			image[index2] = tmp;
-			++index1;																				//move to next index
-			++index2;																				//move to next index
-		}
-	}
-}
\ No newline at end of file
+void ProfilerSignal(int signal) {																//Function to Request a Profiler Dump
+
+	Profiler::instance().requestDump();
+}
+
+void DumpProfile() {																			//Function to Dump Profiler Results
+
+	Profiler::instance().print(std::cout);
+	std::cout << "GPU timer results dropped (not ready): " << GpuTimer::instance().getDropped() << std::endl;
+	GLState::instance().print(std::cout);
+	const RenderQueue::Stats& queueStats = renderQueue.getStats();
+	std::cout << "Draw queue last frame: " << queueStats.draws << " draws, " << queueStats.programBinds << " program changes, "
+		<< queueStats.vaoBinds << " VAO changes, " << queueStats.textureBinds << " texture bind requests, "
+		<< queueStats.instances << " instances, " << queueStats.dropped << " dropped (ring full)" << std::endl;
+	const RingBuffer::Stats& ringStats = frameRing.getStats();
+	std::cout << "Ring buffer: " << frameRing.getFramesInFlight() << " frames in flight x " << frameRing.getRegionSize() / 1024 << " KB, peak "
+		<< ringStats.peakBytes << " bytes/frame, blocked on fences " << ringStats.blockedWaits << " times for "
+		<< ringStats.waitMilliseconds << " ms" << std::endl;
+	JobSystem::instance().print(std::cout);
+	const TextureStreamer::Stats& textureStats = textureStreamer.getStats();
+	std::cout << "Textures: " << textureStats.resident << "/" << textureStats.requested << " resident, " << textureStats.failed << " failed, "
+		<< textureStats.uploadedBytes << " bytes uploaded (peak " << textureStats.peakFrameBytes << " in one frame), worst latency "
+		<< textureStats.maxLatencyMilliseconds << " ms";
+	if (textureStats.previews)
+		std::cout << ", " << textureStats.previews << " previews (worst latency " << textureStats.maxPreviewLatencyMilliseconds << " ms)";
+	if (textureStats.deferred)
+		std::cout << ", " << textureStats.deferred << " uploads deferred (no free PBO)";
+	std::cout << std::endl;
+	Profiler::instance().dumpCSV("profile.csv");
+	Profiler::instance().dumpJSON("profile.json");
+}
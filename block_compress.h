@@ -0,0 +1,870 @@
+#ifndef BLOCK_COMPRESS_H
+#define BLOCK_COMPRESS_H
+
+#include <glad/glad.h>
+
+#include "job_system.h"
+#include "cpu_features.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// S3TC is an extension the 4.3 core loader does not name
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// BCn encoder for cooked textures. Input is always RGBA8; BC1 keeps RGB, BC3
+// RGBA, BC4 red and BC5 red and green, the last two as the unsigned RGTC
+// formats. Each 4x4 block is independent, so rows of blocks are spread over the
+// job system. The per-block palette searches and bounds pick the widest kernel
+// the CPU supports at run time, AVX2 or SSE2, else scalar; every value they
+// sum is a whole number well inside float precision, so all of them produce
+// identical blocks. AVX2 fits 8 pixels of a colour block per register and, for
+// single channels, scores two candidate palettes per register.
+//
+// FAST fits endpoints to the block's bounding box. HIGH starts from the
+// principal axis of the block's colours, refines the endpoints by least squares
+// on the chosen indices and keeps whichever of the candidates has the lowest
+// error; for single channels it searches a few shrunken endpoint pairs and
+// the 6-value mode that keeps exact 0 and 255.
+class BlockCompressor
+{
+public:
+	enum Format { NONE, BC1, BC3, BC4, BC5 };
+	enum Quality { FAST, HIGH };
+	enum Isa { SCALAR, SSE2, AVX2 };
+
+	struct Stats
+	{
+		double psnr = 0.0;												// dB over the format's channels, level 0
+		double megapixelsPerSecond = 0.0;
+		Isa isa = SCALAR;													// kernels the encoder ran
+	};
+
+	static Isa isa() { return active(); }
+
+	// narrows dispatch to at most isa; not for use while an encode runs
+	static void setIsa(Isa isa)
+	{
+		Isa supported = best();
+		active() = isa < supported ? isa : supported;
+	}
+
+	static Isa best()
+	{
+		const CpuFeatures& cpu = CpuFeatures::get();
+		return cpu.avx2 ? AVX2 : cpu.sse2 ? SSE2 : SCALAR;
+	}
+
+	static const char* nameOf(Isa isa)
+	{
+		return isa == AVX2 ? "AVX2" : isa == SSE2 ? "SSE2" : "scalar";
+	}
+
+	static int blockBytes(Format format) { return format == BC1 || format == BC4 ? 8 : 16; }
+
+	static GLenum glFormatOf(Format format)
+	{
+		return format == BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : format == BC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+			: format == BC4 ? GL_COMPRESSED_RED_RGTC1 : GL_COMPRESSED_RG_RGTC2;
+	}
+
+	static const char* nameOf(Format format)
+	{
+		return format == BC1 ? "BC1" : format == BC3 ? "BC3" : format == BC4 ? "BC4" : format == BC5 ? "BC5" : "RGBA8";
+	}
+
+	// compresses a width x height RGBA8 image; edge blocks repeat the last
+	// row and column
+	// ------------------------------------------------------------------------
+	static std::vector<unsigned char> encode(const unsigned char* rgba, int width, int height, Format format, Quality quality)
+	{
+		int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+		int bytes = blockBytes(format);
+		std::vector<unsigned char> blocks((size_t)blocksWide * blocksHigh * bytes);
+		JobSystem::instance().parallelFor(0, blocksHigh, 4, [&](int begin, int end) {
+			alignas(16) unsigned char pixels[64];
+			alignas(16) unsigned char channel[16];
+			for (int by = begin; by < end; ++by)
+			{
+				for (int bx = 0; bx < blocksWide; ++bx)
+				{
+					unsigned char* out = &blocks[((size_t)by * blocksWide + bx) * bytes];
+					fetchBlock(rgba, width, height, bx, by, pixels);
+					if (format == BC1 || format == BC3)
+					{
+						if (format == BC3)
+						{
+							extractChannel(pixels, 3, channel);
+							encodeChannel(channel, quality, out);
+							out += 8;
+						}
+						encodeColor(pixels, quality, out);
+					}
+					else
+					{
+						extractChannel(pixels, 0, channel);
+						encodeChannel(channel, quality, out);
+						if (format == BC5)
+						{
+							extractChannel(pixels, 1, channel);
+							encodeChannel(channel, quality, out + 8);
+						}
+					}
+				}
+			}
+		});
+		return blocks;
+	}
+
+	// expands blocks back to RGBA8; channels a format does not store read as
+	// 0, alpha as 255
+	// ------------------------------------------------------------------------
+	static std::vector<unsigned char> decode(const unsigned char* blocks, int width, int height, Format format)
+	{
+		int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+		int bytes = blockBytes(format);
+		std::vector<unsigned char> rgba((size_t)width * height * 4);
+		for (int by = 0; by < blocksHigh; ++by)
+		{
+			for (int bx = 0; bx < blocksWide; ++bx)
+			{
+				const unsigned char* block = blocks + ((size_t)by * blocksWide + bx) * bytes;
+				unsigned char pixels[64];
+				unsigned char channel[16];
+				for (int i = 0; i < 16; ++i)
+				{
+					pixels[i * 4 + 0] = pixels[i * 4 + 1] = pixels[i * 4 + 2] = 0;
+					pixels[i * 4 + 3] = 255;
+				}
+				if (format == BC1)
+					decodeColor(block, pixels);
+				else if (format == BC3)
+				{
+					decodeColor(block + 8, pixels);
+					decodeChannel(block, channel);
+					for (int i = 0; i < 16; ++i)
+						pixels[i * 4 + 3] = channel[i];
+				}
+				else
+				{
+					decodeChannel(block, channel);
+					for (int i = 0; i < 16; ++i)
+						pixels[i * 4 + 0] = channel[i];
+					if (format == BC5)
+					{
+						decodeChannel(block + 8, channel);
+						for (int i = 0; i < 16; ++i)
+							pixels[i * 4 + 1] = channel[i];
+					}
+				}
+				for (int y = 0; y < 4 && by * 4 + y < height; ++y)
+					for (int x = 0; x < 4 && bx * 4 + x < width; ++x)
+						memcpy(&rgba[((size_t)(by * 4 + y) * width + bx * 4 + x) * 4], &pixels[(y * 4 + x) * 4], 4);
+			}
+		}
+		return rgba;
+	}
+
+	// peak signal to noise ratio over the channels format keeps; 99 dB when exact
+	// ------------------------------------------------------------------------
+	static double psnr(const unsigned char* original, const unsigned char* decoded, int width, int height, Format format)
+	{
+		int channels = format == BC4 ? 1 : format == BC5 ? 2 : format == BC1 ? 3 : 4;
+		double sum = 0.0;
+		size_t pixels = (size_t)width * height;
+		for (size_t i = 0; i < pixels; ++i)
+		{
+			for (int c = 0; c < channels; ++c)
+			{
+				double d = (double)original[i * 4 + c] - decoded[i * 4 + c];
+				sum += d * d;
+			}
+		}
+		double mse = sum / ((double)pixels * channels);
+		return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+	}
+
+private:
+	static Isa& active()
+	{
+		static Isa isa = best();
+		return isa;
+	}
+
+	static void fetchBlock(const unsigned char* rgba, int width, int height, int bx, int by, unsigned char* pixels)
+	{
+		int x0 = bx * 4, y0 = by * 4;
+		for (int y = 0; y < 4; ++y)
+		{
+			int sy = y0 + y < height ? y0 + y : height - 1;
+			const unsigned char* row = rgba + (size_t)sy * width * 4;
+			if (x0 + 4 <= width)
+				memcpy(pixels + y * 16, row + x0 * 4, 16);
+			else
+				for (int x = 0; x < 4; ++x)
+					memcpy(pixels + y * 16 + x * 4, row + (x0 + x < width ? x0 + x : width - 1) * 4, 4);
+		}
+	}
+
+	static void extractChannel(const unsigned char* pixels, int c, unsigned char* channel)
+	{
+		for (int i = 0; i < 16; ++i)
+			channel[i] = pixels[i * 4 + c];
+	}
+
+	// ---- BC1 colour ----------------------------------------------------------
+
+	static int quantize565(const float* color)
+	{
+		int r = (int)(color[0] * 31.0f / 255.0f + 0.5f), g = (int)(color[1] * 63.0f / 255.0f + 0.5f), b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+		r = r < 0 ? 0 : r > 31 ? 31 : r;
+		g = g < 0 ? 0 : g > 63 ? 63 : g;
+		b = b < 0 ? 0 : b > 31 ? 31 : b;
+		return (r << 11) | (g << 5) | b;
+	}
+
+	static void expand565(int c, int* color)
+	{
+		int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	// four-colour palette in index order: c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+	static void colorPalette(int c0, int c1, int palette[4][3])
+	{
+		expand565(c0, palette[0]);
+		expand565(c1, palette[1]);
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+	}
+
+	// nearest palette entry for every pixel; returns the packed 2-bit indices
+	static unsigned int fitColorIndices(const float* r, const float* g, const float* b, const int palette[4][3], float& error)
+	{
+#ifdef CPU_X86
+		if (active() >= AVX2)
+			return fitColorIndicesAVX2(r, g, b, palette, error);
+		if (active() >= SSE2)
+			return fitColorIndicesSSE2(r, g, b, palette, error);
+#endif
+		unsigned int indices = 0;
+		error = 0.0f;
+		for (int i = 0; i < 16; ++i)
+		{
+			float best = 1e30f;
+			unsigned int bestIndex = 0;
+			for (int k = 0; k < 4; ++k)
+			{
+				float dr = r[i] - palette[k][0], dg = g[i] - palette[k][1], db = b[i] - palette[k][2];
+				float d = dr * dr + dg * dg + db * db;
+				if (d < best)
+				{
+					best = d;
+					bestIndex = k;
+				}
+			}
+			indices |= bestIndex << (2 * i);
+			error += best;
+		}
+		return indices;
+	}
+
+	struct ColorFit
+	{
+		int c0, c1;
+		unsigned int indices;
+		float error;
+	};
+
+	// quantizes an endpoint pair and fits indices to it
+	static ColorFit fitColor(const float* r, const float* g, const float* b, const float* hi, const float* lo)
+	{
+		ColorFit fit;
+		fit.c0 = quantize565(hi);
+		fit.c1 = quantize565(lo);
+		if (fit.c0 < fit.c1)
+		{
+			int swap = fit.c0;
+			fit.c0 = fit.c1;
+			fit.c1 = swap;
+		}
+		int palette[4][3];
+		colorPalette(fit.c0, fit.c1, palette);
+		fit.indices = fitColorIndices(r, g, b, palette, fit.error);
+		if (fit.c0 == fit.c1)
+			fit.indices = 0;													// equal endpoints select 3-colour mode; index 0 is still c0
+		return fit;
+	}
+
+	static void encodeColor(const unsigned char* pixels, Quality quality, unsigned char* out)
+	{
+		alignas(32) float r[16], g[16], b[16];
+		for (int i = 0; i < 16; ++i)
+		{
+			r[i] = pixels[i * 4 + 0];
+			g[i] = pixels[i * 4 + 1];
+			b[i] = pixels[i * 4 + 2];
+		}
+
+		// bounding box, inset by 1/16 of its extent so outliers do not waste the palette
+		int mn[4], mx[4];
+		boundsRGBA(pixels, mn, mx);
+		float lo[3], hi[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			float inset = (mx[c] - mn[c]) / 16.0f;
+			lo[c] = mn[c] + inset;
+			hi[c] = mx[c] - inset;
+		}
+		ColorFit best = fitColor(r, g, b, hi, lo);
+
+		if (quality == HIGH && best.error > 0.0f)
+		{
+			float mean[3], axis[3];
+			principalAxis(r, g, b, mean, axis);
+			float tmin = 1e30f, tmax = -1e30f;
+			for (int i = 0; i < 16; ++i)
+			{
+				float t = (r[i] - mean[0]) * axis[0] + (g[i] - mean[1]) * axis[1] + (b[i] - mean[2]) * axis[2];
+				tmin = t < tmin ? t : tmin;
+				tmax = t > tmax ? t : tmax;
+			}
+			for (int c = 0; c < 3; ++c)
+			{
+				lo[c] = clampf(mean[c] + axis[c] * tmin);
+				hi[c] = clampf(mean[c] + axis[c] * tmax);
+			}
+			ColorFit fit = fitColor(r, g, b, hi, lo);
+			for (int iteration = 0; iteration < 2; ++iteration)
+			{
+				if (fit.error < best.error)
+					best = fit;
+				if (!refineColor(r, g, b, fit, hi, lo))
+					break;
+				fit = fitColor(r, g, b, hi, lo);
+			}
+			if (fit.error < best.error)
+				best = fit;
+		}
+
+		out[0] = (unsigned char)(best.c0 & 0xFF);
+		out[1] = (unsigned char)(best.c0 >> 8);
+		out[2] = (unsigned char)(best.c1 & 0xFF);
+		out[3] = (unsigned char)(best.c1 >> 8);
+		for (int i = 0; i < 4; ++i)
+			out[4 + i] = (unsigned char)(best.indices >> (8 * i));
+	}
+
+	// least-squares endpoints for the indices fit chose; false if degenerate
+	static bool refineColor(const float* r, const float* g, const float* b, const ColorFit& fit, float* hi, float* lo)
+	{
+		static const float weight[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };	// share of c0 per index
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = {}, bx[3] = {};
+		for (int i = 0; i < 16; ++i)
+		{
+			float w = weight[(fit.indices >> (2 * i)) & 3], v = 1.0f - w;
+			aa += w * w;
+			ab += w * v;
+			bb += v * v;
+			ax[0] += w * r[i]; ax[1] += w * g[i]; ax[2] += w * b[i];
+			bx[0] += v * r[i]; bx[1] += v * g[i]; bx[2] += v * b[i];
+		}
+		float det = aa * bb - ab * ab;
+		if (std::fabs(det) < 1e-6f)
+			return false;
+		for (int c = 0; c < 3; ++c)
+		{
+			hi[c] = clampf((bb * ax[c] - ab * bx[c]) / det);
+			lo[c] = clampf((aa * bx[c] - ab * ax[c]) / det);
+		}
+		return true;
+	}
+
+	// mean and dominant direction of the block's colours by power iteration
+	static void principalAxis(const float* r, const float* g, const float* b, float* mean, float* axis)
+	{
+		float sum[3] = {}, cov[6] = {};
+#ifdef CPU_X86
+		if (active() >= AVX2)
+			momentsAVX2(r, g, b, sum, cov);
+		else if (active() >= SSE2)
+			momentsSSE2(r, g, b, sum, cov);
+		else
+#endif
+		for (int i = 0; i < 16; ++i)
+		{
+			sum[0] += r[i]; sum[1] += g[i]; sum[2] += b[i];
+			cov[0] += r[i] * r[i]; cov[1] += r[i] * g[i]; cov[2] += r[i] * b[i];
+			cov[3] += g[i] * g[i]; cov[4] += g[i] * b[i]; cov[5] += b[i] * b[i];
+		}
+		for (int c = 0; c < 3; ++c)
+			mean[c] = sum[c] / 16.0f;
+		// sums of products to covariance: E[xy] - E[x]E[y]
+		cov[0] = cov[0] / 16.0f - mean[0] * mean[0];
+		cov[1] = cov[1] / 16.0f - mean[0] * mean[1];
+		cov[2] = cov[2] / 16.0f - mean[0] * mean[2];
+		cov[3] = cov[3] / 16.0f - mean[1] * mean[1];
+		cov[4] = cov[4] / 16.0f - mean[1] * mean[2];
+		cov[5] = cov[5] / 16.0f - mean[2] * mean[2];
+
+		float v[3] = { 1.0f, 1.0f, 1.0f };
+		for (int iteration = 0; iteration < 8; ++iteration)
+		{
+			float x = cov[0] * v[0] + cov[1] * v[1] + cov[2] * v[2];
+			float y = cov[1] * v[0] + cov[3] * v[1] + cov[4] * v[2];
+			float z = cov[2] * v[0] + cov[4] * v[1] + cov[5] * v[2];
+			float length = std::sqrt(x * x + y * y + z * z);
+			if (length < 1e-6f)
+				break;
+			v[0] = x / length;
+			v[1] = y / length;
+			v[2] = z / length;
+		}
+		float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		for (int c = 0; c < 3; ++c)
+			axis[c] = v[c] / length;
+	}
+
+	static void decodeColor(const unsigned char* block, unsigned char* pixels)
+	{
+		int c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+		int palette[4][3];
+		colorPalette(c0, c1, palette);
+		if (c0 <= c1)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+		unsigned int indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned int)block[7] << 24);
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < 3; ++c)
+				pixels[i * 4 + c] = (unsigned char)palette[(indices >> (2 * i)) & 3][c];
+	}
+
+	// ---- BC4 single channel --------------------------------------------------
+
+	// eight-value palette for a0 > a1, six values plus 0 and 255 otherwise
+	static void channelPalette(int a0, int a1, int* palette)
+	{
+		palette[0] = a0;
+		palette[1] = a1;
+		if (a0 > a1)
+			for (int k = 2; k < 8; ++k)
+				palette[k] = ((8 - k) * a0 + (k - 1) * a1 + 3) / 7;
+		else
+		{
+			for (int k = 2; k < 6; ++k)
+				palette[k] = ((6 - k) * a0 + (k - 1) * a1 + 2) / 5;
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	// nearest palette entry for every value; returns the packed 3-bit indices
+	static unsigned long long fitChannelIndices(const unsigned char* values, const int* palette, int& error)
+	{
+		alignas(16) unsigned char index[16];
+#ifdef CPU_X86
+		if (active() >= SSE2)
+			error = fitChannelSSE2(values, palette, index);
+		else
+#endif
+		{
+			error = 0;
+			for (int i = 0; i < 16; ++i)
+			{
+				int bestDistance = 256;
+				for (int k = 0; k < 8; ++k)
+				{
+					int d = values[i] > palette[k] ? values[i] - palette[k] : palette[k] - values[i];
+					if (d <= bestDistance)										// ties go to the later entry, as in the kernels
+					{
+						bestDistance = d;
+						index[i] = (unsigned char)k;
+					}
+				}
+				error += bestDistance * bestDistance;
+			}
+		}
+		return packChannelIndices(index);
+	}
+
+	static unsigned long long packChannelIndices(const unsigned char* index)
+	{
+		unsigned long long indices = 0;
+		for (int i = 0; i < 16; ++i)
+			indices |= (unsigned long long)index[i] << (3 * i);
+		return indices;
+	}
+
+	// HIGH's endpoint candidates, scored in order; the first with the lowest
+	// error wins. AVX2 scores two per call.
+	static void fitChannelCandidates(const unsigned char* values, const int (*endpoints)[2], int count,
+		int& bestA0, int& bestA1, unsigned long long& bestIndices, int& bestError)
+	{
+		int palettes[2][8];
+		for (int i = 0; i < count; i += 2)
+		{
+			int batch = i + 1 < count ? 2 : 1;
+			for (int j = 0; j < batch; ++j)
+				channelPalette(endpoints[i + j][0], endpoints[i + j][1], palettes[j]);
+			unsigned long long indices[2];
+			int errors[2];
+#ifdef CPU_X86
+			if (batch == 2 && active() >= AVX2)
+			{
+				alignas(32) unsigned char index[32];
+				fitChannelPairAVX2(values, palettes[0], palettes[1], index, errors);
+				indices[0] = packChannelIndices(index);
+				indices[1] = packChannelIndices(index + 16);
+			}
+			else
+#endif
+			for (int j = 0; j < batch; ++j)
+				indices[j] = fitChannelIndices(values, palettes[j], errors[j]);
+			for (int j = 0; j < batch; ++j)
+			{
+				if (errors[j] < bestError)
+				{
+					bestError = errors[j];
+					bestA0 = endpoints[i + j][0];
+					bestA1 = endpoints[i + j][1];
+					bestIndices = indices[j];
+				}
+			}
+		}
+	}
+
+	static void encodeChannel(const unsigned char* values, Quality quality, unsigned char* out)
+	{
+		int mn = 255, mx = 0;
+		boundsChannel(values, mn, mx);
+
+		int palette[8];
+		int bestA0 = mx, bestA1 = mn, bestError;
+		unsigned long long bestIndices = 0;
+		if (mn == mx)
+			bestError = 0;													// flat block: every index 0 reads a0
+		else
+		{
+			channelPalette(mx, mn, palette);
+			bestIndices = fitChannelIndices(values, palette, bestError);
+		}
+
+		if (quality == HIGH && bestError > 0)
+		{
+			int endpoints[16][2], count = 0;
+			// shrink the range from either end: values cluster inside it more often than not
+			for (int top = 0; top <= 3; ++top)
+			{
+				for (int bottom = 0; bottom <= 3; ++bottom)
+				{
+					int a0 = mx - top, a1 = mn + bottom;
+					if ((top == 0 && bottom == 0) || a0 <= a1)
+						continue;
+					endpoints[count][0] = a0;
+					endpoints[count++][1] = a1;
+				}
+			}
+			// six-value mode spends two entries on exact 0 and 255
+			int inner0 = 255, inner1 = 0;
+			for (int i = 0; i < 16; ++i)
+			{
+				if (values[i] != 0 && values[i] < inner0)
+					inner0 = values[i];
+				if (values[i] != 255 && values[i] > inner1)
+					inner1 = values[i];
+			}
+			if (inner0 <= inner1)
+			{
+				endpoints[count][0] = inner0;
+				endpoints[count++][1] = inner1;
+			}
+			fitChannelCandidates(values, endpoints, count, bestA0, bestA1, bestIndices, bestError);
+		}
+
+		out[0] = (unsigned char)bestA0;
+		out[1] = (unsigned char)bestA1;
+		for (int i = 0; i < 6; ++i)
+			out[2 + i] = (unsigned char)(bestIndices >> (8 * i));
+	}
+
+	static void decodeChannel(const unsigned char* block, unsigned char* values)
+	{
+		int palette[8];
+		channelPalette(block[0], block[1], palette);
+		unsigned long long indices = 0;
+		for (int i = 0; i < 6; ++i)
+			indices |= (unsigned long long)block[2 + i] << (8 * i);
+		for (int i = 0; i < 16; ++i)
+			values[i] = (unsigned char)palette[(indices >> (3 * i)) & 7];
+	}
+
+	// ---- helpers -------------------------------------------------------------
+
+	// per-channel minimum and maximum of 16 RGBA pixels
+	static void boundsRGBA(const unsigned char* pixels, int* mn, int* mx)
+	{
+#ifdef CPU_X86
+		if (active() >= SSE2)
+		{
+			unsigned int packedLo, packedHi;
+			if (active() >= AVX2)
+				boundsRGBAAVX2(pixels, packedLo, packedHi);
+			else
+				boundsRGBASSE2(pixels, packedLo, packedHi);
+			for (int c = 0; c < 4; ++c)
+			{
+				mn[c] = (packedLo >> (8 * c)) & 0xFF;
+				mx[c] = (packedHi >> (8 * c)) & 0xFF;
+			}
+			return;
+		}
+#endif
+		for (int c = 0; c < 4; ++c)
+		{
+			mn[c] = 255;
+			mx[c] = 0;
+		}
+		for (int i = 0; i < 16; ++i)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				int v = pixels[i * 4 + c];
+				mn[c] = v < mn[c] ? v : mn[c];
+				mx[c] = v > mx[c] ? v : mx[c];
+			}
+		}
+	}
+
+	static void boundsChannel(const unsigned char* values, int& mn, int& mx)
+	{
+#ifdef CPU_X86
+		if (active() >= SSE2)
+		{
+			boundsChannelSSE2(values, mn, mx);
+			return;
+		}
+#endif
+		mn = 255;
+		mx = 0;
+		for (int i = 0; i < 16; ++i)
+		{
+			mn = values[i] < mn ? values[i] : mn;
+			mx = values[i] > mx ? values[i] : mx;
+		}
+	}
+
+	static float clampf(float v) { return v < 0.0f ? 0.0f : v > 255.0f ? 255.0f : v; }
+
+#ifdef CPU_X86
+	// ---- kernels -------------------------------------------------------------
+
+	CPU_TARGET_SSE2 static unsigned int fitColorIndicesSSE2(const float* r, const float* g, const float* b, const int palette[4][3], float& error)
+	{
+		unsigned int indices = 0;
+		error = 0.0f;
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 pr = _mm_load_ps(r + i), pg = _mm_load_ps(g + i), pb = _mm_load_ps(b + i);
+			__m128 best = _mm_set1_ps(1e30f), bestIndex = _mm_setzero_ps();
+			for (int k = 0; k < 4; ++k)
+			{
+				__m128 dr = _mm_sub_ps(pr, _mm_set1_ps((float)palette[k][0]));
+				__m128 dg = _mm_sub_ps(pg, _mm_set1_ps((float)palette[k][1]));
+				__m128 db = _mm_sub_ps(pb, _mm_set1_ps((float)palette[k][2]));
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+				__m128 closer = _mm_cmplt_ps(d, best);
+				best = _mm_min_ps(d, best);
+				bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((float)k)), _mm_andnot_ps(closer, bestIndex));
+			}
+			alignas(16) float lane[4], distance[4];
+			_mm_store_ps(lane, bestIndex);
+			_mm_store_ps(distance, best);
+			for (int j = 0; j < 4; ++j)
+			{
+				indices |= (unsigned int)lane[j] << (2 * (i + j));
+				error += distance[j];
+			}
+		}
+		return indices;
+	}
+
+	// 8 pixels per register; the indices are packed with one shift per lane
+	// and an or-reduction instead of a store and scalar loop
+	CPU_TARGET_AVX2 static unsigned int fitColorIndicesAVX2(const float* r, const float* g, const float* b, const int palette[4][3], float& error)
+	{
+		__m256 sum = _mm256_setzero_ps();
+		__m256i packed = _mm256_setzero_si256();
+		for (int i = 0; i < 16; i += 8)
+		{
+			__m256 pr = _mm256_loadu_ps(r + i), pg = _mm256_loadu_ps(g + i), pb = _mm256_loadu_ps(b + i);
+			__m256 best = _mm256_set1_ps(1e30f);
+			__m256i bestIndex = _mm256_setzero_si256();
+			for (int k = 0; k < 4; ++k)
+			{
+				__m256 dr = _mm256_sub_ps(pr, _mm256_set1_ps((float)palette[k][0]));
+				__m256 dg = _mm256_sub_ps(pg, _mm256_set1_ps((float)palette[k][1]));
+				__m256 db = _mm256_sub_ps(pb, _mm256_set1_ps((float)palette[k][2]));
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dr, dr), _mm256_mul_ps(dg, dg)), _mm256_mul_ps(db, db));
+				__m256 closer = _mm256_cmp_ps(d, best, _CMP_LT_OQ);
+				best = _mm256_min_ps(d, best);
+				bestIndex = _mm256_blendv_epi8(bestIndex, _mm256_set1_epi32(k), _mm256_castps_si256(closer));
+			}
+			sum = _mm256_add_ps(sum, best);
+			__m256i shifts = _mm256_setr_epi32(2 * i, 2 * i + 2, 2 * i + 4, 2 * i + 6, 2 * i + 8, 2 * i + 10, 2 * i + 12, 2 * i + 14);
+			packed = _mm256_or_si256(packed, _mm256_sllv_epi32(bestIndex, shifts));
+		}
+		__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+		error = horizontalSum(half);
+		__m128i bits = _mm_or_si128(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+		bits = _mm_or_si128(bits, _mm_shuffle_epi32(bits, _MM_SHUFFLE(1, 0, 3, 2)));
+		bits = _mm_or_si128(bits, _mm_shuffle_epi32(bits, _MM_SHUFFLE(2, 3, 0, 1)));
+		return (unsigned int)_mm_cvtsi128_si32(bits);
+	}
+
+	// sums of r, g, b and of their pairwise products, the latter in the order
+	// rr, rg, rb, gg, gb, bb
+	CPU_TARGET_SSE2 static void momentsSSE2(const float* r, const float* g, const float* b, float* sum, float* cov)
+	{
+		__m128 sr = _mm_setzero_ps(), sg = _mm_setzero_ps(), sb = _mm_setzero_ps();
+		__m128 srr = _mm_setzero_ps(), sgg = _mm_setzero_ps(), sbb = _mm_setzero_ps();
+		__m128 srg = _mm_setzero_ps(), srb = _mm_setzero_ps(), sgb = _mm_setzero_ps();
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 pr = _mm_load_ps(r + i), pg = _mm_load_ps(g + i), pb = _mm_load_ps(b + i);
+			sr = _mm_add_ps(sr, pr); sg = _mm_add_ps(sg, pg); sb = _mm_add_ps(sb, pb);
+			srr = _mm_add_ps(srr, _mm_mul_ps(pr, pr)); sgg = _mm_add_ps(sgg, _mm_mul_ps(pg, pg)); sbb = _mm_add_ps(sbb, _mm_mul_ps(pb, pb));
+			srg = _mm_add_ps(srg, _mm_mul_ps(pr, pg)); srb = _mm_add_ps(srb, _mm_mul_ps(pr, pb)); sgb = _mm_add_ps(sgb, _mm_mul_ps(pg, pb));
+		}
+		sum[0] = horizontalSum(sr); sum[1] = horizontalSum(sg); sum[2] = horizontalSum(sb);
+		cov[0] = horizontalSum(srr); cov[1] = horizontalSum(srg); cov[2] = horizontalSum(srb);
+		cov[3] = horizontalSum(sgg); cov[4] = horizontalSum(sgb); cov[5] = horizontalSum(sbb);
+	}
+
+	CPU_TARGET_AVX2 static void momentsAVX2(const float* r, const float* g, const float* b, float* sum, float* cov)
+	{
+		__m256 r0 = _mm256_loadu_ps(r), g0 = _mm256_loadu_ps(g), b0 = _mm256_loadu_ps(b);
+		__m256 r1 = _mm256_loadu_ps(r + 8), g1 = _mm256_loadu_ps(g + 8), b1 = _mm256_loadu_ps(b + 8);
+		__m256 sums[9] = {
+			_mm256_add_ps(r0, r1), _mm256_add_ps(g0, g1), _mm256_add_ps(b0, b1),
+			_mm256_add_ps(_mm256_mul_ps(r0, r0), _mm256_mul_ps(r1, r1)), _mm256_add_ps(_mm256_mul_ps(r0, g0), _mm256_mul_ps(r1, g1)),
+			_mm256_add_ps(_mm256_mul_ps(r0, b0), _mm256_mul_ps(r1, b1)), _mm256_add_ps(_mm256_mul_ps(g0, g0), _mm256_mul_ps(g1, g1)),
+			_mm256_add_ps(_mm256_mul_ps(g0, b0), _mm256_mul_ps(g1, b1)), _mm256_add_ps(_mm256_mul_ps(b0, b0), _mm256_mul_ps(b1, b1)) };
+		float* out[9] = { &sum[0], &sum[1], &sum[2], &cov[0], &cov[1], &cov[2], &cov[3], &cov[4], &cov[5] };
+		for (int i = 0; i < 9; ++i)
+			*out[i] = horizontalSum(_mm_add_ps(_mm256_castps256_ps128(sums[i]), _mm256_extractf128_ps(sums[i], 1)));
+	}
+
+	// writes the 16 indices, returns the squared error
+	CPU_TARGET_SSE2 static int fitChannelSSE2(const unsigned char* values, const int* palette, unsigned char* index)
+	{
+		__m128i v = _mm_load_si128((const __m128i*)values);
+		__m128i p = _mm_set1_epi8((char)palette[0]);
+		__m128i best = _mm_sub_epi8(_mm_max_epu8(v, p), _mm_min_epu8(v, p)), bestIndex = _mm_setzero_si128();
+		for (int k = 1; k < 8; ++k)
+		{
+			p = _mm_set1_epi8((char)palette[k]);
+			__m128i d = _mm_sub_epi8(_mm_max_epu8(v, p), _mm_min_epu8(v, p));		// |v - p| without signed bytes
+			__m128i closer = _mm_cmpeq_epi8(_mm_min_epu8(d, best), d);
+			best = _mm_min_epu8(d, best);
+			bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi8((char)k)), _mm_andnot_si128(closer, bestIndex));
+		}
+		_mm_store_si128((__m128i*)index, bestIndex);
+		// squared error: widen to 16 bits and multiply-add pairs
+		__m128i low = _mm_unpacklo_epi8(best, _mm_setzero_si128()), high = _mm_unpackhi_epi8(best, _mm_setzero_si128());
+		__m128i squares = _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high));
+		squares = _mm_add_epi32(squares, _mm_shuffle_epi32(squares, _MM_SHUFFLE(1, 0, 3, 2)));
+		squares = _mm_add_epi32(squares, _mm_shuffle_epi32(squares, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(squares);
+	}
+
+	// fitChannelSSE2 for two palettes at once, one per 128-bit lane; index gets
+	// 16 indices per palette
+	CPU_TARGET_AVX2 static void fitChannelPairAVX2(const unsigned char* values, const int* paletteA, const int* paletteB, unsigned char* index, int* error)
+	{
+		__m256i v = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)values));
+		__m256i best = _mm256_set1_epi8((char)255), bestIndex = _mm256_setzero_si256();
+		for (int k = 0; k < 8; ++k)
+		{
+			__m256i p = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_set1_epi8((char)paletteA[k])), _mm_set1_epi8((char)paletteB[k]), 1);
+			__m256i d = _mm256_sub_epi8(_mm256_max_epu8(v, p), _mm256_min_epu8(v, p));
+			__m256i closer = _mm256_cmpeq_epi8(_mm256_min_epu8(d, best), d);
+			best = _mm256_min_epu8(d, best);
+			bestIndex = _mm256_blendv_epi8(bestIndex, _mm256_set1_epi8((char)k), closer);
+		}
+		_mm256_store_si256((__m256i*)index, bestIndex);
+		__m256i low = _mm256_unpacklo_epi8(best, _mm256_setzero_si256()), high = _mm256_unpackhi_epi8(best, _mm256_setzero_si256());
+		__m256i squares = _mm256_add_epi32(_mm256_madd_epi16(low, low), _mm256_madd_epi16(high, high));
+		squares = _mm256_add_epi32(squares, _mm256_shuffle_epi32(squares, _MM_SHUFFLE(1, 0, 3, 2)));
+		squares = _mm256_add_epi32(squares, _mm256_shuffle_epi32(squares, _MM_SHUFFLE(2, 3, 0, 1)));
+		error[0] = _mm256_extract_epi32(squares, 0);
+		error[1] = _mm256_extract_epi32(squares, 4);
+	}
+
+	CPU_TARGET_SSE2 static void boundsRGBASSE2(const unsigned char* pixels, unsigned int& packedLo, unsigned int& packedHi)
+	{
+		__m128i row0 = _mm_loadu_si128((const __m128i*)pixels), row1 = _mm_loadu_si128((const __m128i*)(pixels + 16));
+		__m128i row2 = _mm_loadu_si128((const __m128i*)(pixels + 32)), row3 = _mm_loadu_si128((const __m128i*)(pixels + 48));
+		__m128i lo = _mm_min_epu8(_mm_min_epu8(row0, row1), _mm_min_epu8(row2, row3));
+		__m128i hi = _mm_max_epu8(_mm_max_epu8(row0, row1), _mm_max_epu8(row2, row3));
+		foldBounds(lo, hi, packedLo, packedHi);
+	}
+
+	CPU_TARGET_AVX2 static void boundsRGBAAVX2(const unsigned char* pixels, unsigned int& packedLo, unsigned int& packedHi)
+	{
+		__m256i top = _mm256_loadu_si256((const __m256i*)pixels), bottom = _mm256_loadu_si256((const __m256i*)(pixels + 32));
+		__m256i lo = _mm256_min_epu8(top, bottom), hi = _mm256_max_epu8(top, bottom);
+		foldBounds(_mm_min_epu8(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1)),
+			_mm_max_epu8(_mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1)), packedLo, packedHi);
+	}
+
+	// four RGBA minima and maxima down to one, packed as bytes
+	CPU_TARGET_SSE2 static void foldBounds(__m128i lo, __m128i hi, unsigned int& packedLo, unsigned int& packedHi)
+	{
+		lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+		lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+		hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+		hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+		packedLo = (unsigned int)_mm_cvtsi128_si32(lo);
+		packedHi = (unsigned int)_mm_cvtsi128_si32(hi);
+	}
+
+	CPU_TARGET_SSE2 static void boundsChannelSSE2(const unsigned char* values, int& mn, int& mx)
+	{
+		__m128i v = _mm_load_si128((const __m128i*)values);
+		__m128i lo = _mm_min_epu8(v, _mm_srli_si128(v, 8)), hi = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+		lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+		hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+		lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 2));
+		hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 2));
+		lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 1));
+		hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 1));
+		mn = _mm_cvtsi128_si32(lo) & 0xFF;
+		mx = _mm_cvtsi128_si32(hi) & 0xFF;
+	}
+
+	CPU_TARGET_SSE2 static float horizontalSum(__m128 v)
+	{
+		v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(v);
+	}
+#endif
+};
+#endif
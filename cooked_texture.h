@@ -0,0 +1,306 @@
+#ifndef COOKED_TEXTURE_H
+#define COOKED_TEXTURE_H
+
+#include <glad/glad.h>
+
+#include "stb_image.h"
+#include "gl_state.h"
+#include "block_compress.h"
+#include "mip_generator.h"
+#include "image_ops.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Offline-cooked texture: everything a texture array layer's sub-image uploads
+// need, with no decode step. The file is a 4 KB header page followed by the mip
+// chain, every level starting on a 4 KB boundary so the mapped pages can be
+// handed to GL as they are. format == 0 marks block-compressed levels, uploaded
+// with glCompressedTexSubImage3D.
+//
+//   "PTEX" | version | internalFormat | format | type | width | height | levels
+//   | level table (offset, size, width, height) x levels | padding to 4096
+//   | level 0 | padding | level 1 | ...
+class CookedTexture
+{
+public:
+	static const uint32_t VERSION = 1;
+	static const uint32_t ALIGNMENT = 4096;
+	static const int MAX_LEVELS = 16;
+
+	struct Level
+	{
+		uint64_t offset;
+		uint64_t size;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t internalFormat;											// sized GL format, e.g. GL_RGBA8
+		uint32_t format;													// GL pixel format, 0 if block-compressed
+		uint32_t type;														// GL pixel type, 0 if block-compressed
+		uint32_t width;
+		uint32_t height;
+		uint32_t levels;
+		Level level[MAX_LEVELS];
+	};
+	static_assert(sizeof(Header) <= ALIGNMENT, "Header must fit in the first page");
+
+	CookedTexture() {}
+	CookedTexture(const CookedTexture&) = delete;
+	CookedTexture& operator=(const CookedTexture&) = delete;
+	~CookedTexture() { close(); }
+
+	// "textures/brick.png" -> "textures/brick.ctex"
+	// ------------------------------------------------------------------------
+	static std::string pathFor(const char* source)
+	{
+		std::string path(source);
+		size_t dot = path.find_last_of('.');
+		size_t slash = path.find_last_of("/\\");
+		if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+			path.erase(dot);
+		return path + ".ctex";
+	}
+
+	// maps the file and checks its header; false if missing or malformed. Every
+	// level must be the size GL will read for it, so a truncated or mismatched
+	// file never reaches glTexSubImage
+	// ------------------------------------------------------------------------
+	bool open(const char* path)
+	{
+		close();
+		if (!map(path))
+			return false;
+		if (size < sizeof(Header) || memcmp(header().magic, "PTEX", 4) != 0 || header().version != VERSION
+			|| header().levels == 0 || header().levels > (uint32_t)MAX_LEVELS || header().width == 0 || header().height == 0
+			|| levelBytes(header(), 1, 1) == 0)
+		{
+			close();
+			return false;
+		}
+		for (uint32_t i = 0; i < header().levels; ++i)
+		{
+			const Level& level = header().level[i];
+			uint32_t width = header().width >> i > 0 ? header().width >> i : 1;
+			uint32_t height = header().height >> i > 0 ? header().height >> i : 1;
+			if (level.width != width || level.height != height || level.size != levelBytes(header(), width, height)
+				|| level.offset % ALIGNMENT != 0 || level.offset > size || level.size > size - level.offset)
+			{
+				close();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void close()
+	{
+#if defined(_WIN32)
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data)
+			munmap(data, size);
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	const Header& header() const { return *(const Header*)data; }
+	const unsigned char* levelData(int i) const { return (const unsigned char*)data + header().level[i].offset; }
+	bool compressed() const { return header().format == 0; }
+
+	// copies every level into layer of an array allocated with the same format,
+	// size and level count
+	// ------------------------------------------------------------------------
+	void uploadLayer(GLuint array, int layer) const
+	{
+		const Header& h = header();
+		GLState::instance().bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, array);
+		for (uint32_t i = 0; i < h.levels; ++i)
+		{
+			const Level& level = h.level[i];
+			if (compressed())
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, level.width, level.height, 1,
+					h.internalFormat, (GLsizei)level.size, levelData(i));
+			else
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, level.width, level.height, 1, h.format, h.type, levelData(i));
+		}
+	}
+
+	// decodes source once and writes its mip chain to destination, as RGBA8 or
+	// block-compressed; stats, if given, gets the encoder's PSNR, throughput and
+	// the instruction set it ran on
+	// ------------------------------------------------------------------------
+	static bool cook(const char* source, const char* destination, const MipGenerator::Options& mips = MipGenerator::Options(),
+		BlockCompressor::Format compression = BlockCompressor::NONE, BlockCompressor::Quality quality = BlockCompressor::HIGH,
+		BlockCompressor::Stats* stats = nullptr)
+	{
+		int width, height, components;
+		unsigned char* pixels = stbi_load(source, &width, &height, &components, 0);
+		if (!pixels)
+			return false;
+
+		std::vector<std::vector<unsigned char>> levels;
+		levels.emplace_back((size_t)width * height * 4);
+		ImageOps::expand(pixels, levels[0].data(), (size_t)width * height, components, 4);
+		stbi_image_free(pixels);
+		std::vector<int> widths(1, width), heights(1, height);
+		std::vector<MipGenerator::Level> chain = MipGenerator::build(levels[0].data(), width, height, 4, mips);
+		for (size_t i = 0; i < chain.size() && levels.size() < (size_t)MAX_LEVELS; ++i)
+		{
+			levels.push_back(std::move(chain[i].pixels));
+			widths.push_back(chain[i].width);
+			heights.push_back(chain[i].height);
+		}
+
+		if (compression != BlockCompressor::NONE)
+		{
+			auto start = std::chrono::steady_clock::now();
+			double megapixels = 0.0;
+			std::vector<unsigned char> base = levels[0];
+			for (size_t i = 0; i < levels.size(); ++i)
+			{
+				levels[i] = BlockCompressor::encode(levels[i].data(), widths[i], heights[i], compression, quality);
+				megapixels += (double)widths[i] * heights[i] / 1e6;
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (stats)
+			{
+				std::vector<unsigned char> decoded = BlockCompressor::decode(levels[0].data(), width, height, compression);
+				stats->psnr = BlockCompressor::psnr(base.data(), decoded.data(), width, height, compression);
+				stats->megapixelsPerSecond = seconds > 0.0 ? megapixels / seconds : 0.0;
+				stats->isa = BlockCompressor::isa();
+			}
+		}
+
+		Header header = {};
+		memcpy(header.magic, "PTEX", 4);
+		header.version = VERSION;
+		header.internalFormat = compression == BlockCompressor::NONE ? GL_RGBA8 : BlockCompressor::glFormatOf(compression);
+		header.format = compression == BlockCompressor::NONE ? GL_RGBA : 0;
+		header.type = compression == BlockCompressor::NONE ? GL_UNSIGNED_BYTE : 0;
+		header.width = width;
+		header.height = height;
+		header.levels = (uint32_t)levels.size();
+		uint64_t offset = ALIGNMENT;
+		for (size_t i = 0; i < levels.size(); ++i)
+		{
+			header.level[i].offset = offset;
+			header.level[i].size = levels[i].size();
+			header.level[i].width = widths[i];
+			header.level[i].height = heights[i];
+			offset += (levels[i].size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		}
+		return write(destination, header, levels);
+	}
+
+	// writes header and level payloads at the offsets recorded in the header
+	// ------------------------------------------------------------------------
+	static bool write(const char* destination, const Header& header, const std::vector<std::vector<unsigned char>>& levels)
+	{
+		FILE* out = fopen(destination, "wb");
+		if (!out)
+			return false;
+		std::vector<unsigned char> page(ALIGNMENT + sizeof(Header), 0);	// header page; its zero tail doubles as level padding
+		memcpy(page.data(), &header, sizeof(Header));
+		bool ok = fwrite(page.data(), 1, ALIGNMENT, out) == ALIGNMENT;
+		uint64_t position = ALIGNMENT;
+		for (size_t i = 0; i < levels.size() && ok; ++i)
+		{
+			ok = fwrite(levels[i].data(), 1, levels[i].size(), out) == levels[i].size();
+			position += levels[i].size();
+			uint64_t padding = (ALIGNMENT - position % ALIGNMENT) % ALIGNMENT;
+			ok = ok && (padding == 0 || fwrite(page.data() + sizeof(Header), 1, (size_t)padding, out) == padding);
+			position += padding;
+		}
+		return fclose(out) == 0 && ok;
+	}
+
+private:
+	// bytes of a width x height level in the header's format, 0 for a format
+	// cook() never writes
+	static uint64_t levelBytes(const Header& h, uint32_t width, uint32_t height)
+	{
+		if (h.internalFormat == GL_RGBA8 && h.format == GL_RGBA && h.type == GL_UNSIGNED_BYTE)
+			return (uint64_t)width * height * 4;
+		const BlockCompressor::Format formats[] = { BlockCompressor::BC1, BlockCompressor::BC3, BlockCompressor::BC4, BlockCompressor::BC5 };
+		for (BlockCompressor::Format format : formats)
+			if (h.internalFormat == BlockCompressor::glFormatOf(format) && h.format == 0 && h.type == 0)
+				return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * BlockCompressor::blockBytes(format);
+		return 0;
+	}
+
+	bool map(const char* path)
+	{
+#if defined(_WIN32)
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER length;
+		if (!GetFileSizeEx(file, &length) || length.QuadPart == 0)
+			return false;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping)
+			return false;
+		data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		size = (size_t)length.QuadPart;
+		return data != nullptr;
+#else
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);												// the mapping keeps the file alive
+		if (mapped == MAP_FAILED)
+			return false;
+		data = mapped;
+		size = (size_t)info.st_size;
+		return true;
+#endif
+	}
+
+	void* data = nullptr;
+	size_t size = 0;
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#endif
+};
+#endif
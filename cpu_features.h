@@ -0,0 +1,99 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include <ostream>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386) || defined(_M_IX86)
+#define CPU_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// GCC and Clang only emit instructions the whole file was compiled for unless a
+// function opts in, so kernels for newer instruction sets are tagged with these
+// and only called after CpuFeatures says the CPU has them. MSVC needs no tag.
+#if defined(CPU_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_TARGET_SSE2 __attribute__((target("sse2")))
+#define CPU_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define CPU_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CPU_TARGET_SSE2
+#define CPU_TARGET_SSSE3
+#define CPU_TARGET_SSE41
+#define CPU_TARGET_AVX2
+#endif
+
+// Instruction sets the running CPU and OS support, detected once with cpuid.
+// AVX2 also needs the OS to save the upper halves of the ymm registers, which
+// xgetbv reports.
+class CpuFeatures
+{
+public:
+	bool sse2 = false;
+	bool ssse3 = false;
+	bool sse41 = false;
+	bool avx2 = false;
+
+	static const CpuFeatures& get()
+	{
+		static const CpuFeatures features = detect();
+		return features;
+	}
+
+	void print(std::ostream& out) const
+	{
+		out << "CPU features:" << (sse2 ? " SSE2" : "") << (ssse3 ? " SSSE3" : "") << (sse41 ? " SSE4.1" : "")
+			<< (avx2 ? " AVX2" : "") << (!sse2 ? " none" : "") << std::endl;
+	}
+
+private:
+	static CpuFeatures detect()
+	{
+		CpuFeatures features;
+#ifdef CPU_X86
+		unsigned int leaf1[4] = {}, leaf7[4] = {};
+		cpuid(1, leaf1);
+		cpuid(7, leaf7);
+		features.sse2 = (leaf1[3] & (1u << 26)) != 0;
+		features.ssse3 = (leaf1[2] & (1u << 9)) != 0;
+		features.sse41 = (leaf1[2] & (1u << 19)) != 0;
+		bool osxsave = (leaf1[2] & (1u << 27)) != 0, avx = (leaf1[2] & (1u << 28)) != 0;
+		features.avx2 = osxsave && avx && (xcr0() & 6) == 6 && (leaf7[1] & (1u << 5)) != 0;
+#endif
+		return features;
+	}
+
+#ifdef CPU_X86
+	// eax, ebx, ecx, edx of a leaf, sub-leaf 0
+	static void cpuid(unsigned int leaf, unsigned int* regs)
+	{
+#if defined(_MSC_VER)
+		int r[4];
+		__cpuidex(r, (int)leaf, 0);
+		for (int i = 0; i < 4; ++i)
+			regs[i] = (unsigned int)r[i];
+#else
+		if (leaf > __get_cpuid_max(0, nullptr))
+			return;
+		__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	}
+
+	static unsigned long long xcr0()
+	{
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		unsigned int eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return ((unsigned long long)edx << 32) | eax;
+#endif
+	}
+#endif
+};
+#endif
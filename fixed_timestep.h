@@ -0,0 +1,44 @@
+#ifndef FIXED_TIMESTEP_H
+#define FIXED_TIMESTEP_H
+
+// Accumulator for a fixed-rate simulation driven by a variable-rate frame loop.
+// Each frame adds its real elapsed time and runs however many whole steps fit;
+// the leftover fraction of a step is the interpolation factor the renderer uses
+// to blend the previous and current simulation states.
+class FixedTimestep
+{
+public:
+	explicit FixedTimestep(double stepsPerSecond, int maxStepsPerFrame = 8)
+		: step(1.0 / stepsPerSecond), maxSteps(maxStepsPerFrame), accumulator(0.0), droppedTime(0.0) {}
+
+	// adds a frame's elapsed time and returns how many simulation steps to run
+	// ------------------------------------------------------------------------
+	int advance(double frameSeconds)
+	{
+		accumulator += frameSeconds;
+		int steps = (int)(accumulator / step);
+		if (steps > maxSteps)
+		{
+			// after a long stall drop the backlog instead of spiralling: the
+			// simulation runs slow for that frame but never falls further behind
+			droppedTime += (steps - maxSteps) * step;
+			steps = maxSteps;
+		}
+		accumulator -= (int)(accumulator / step) * step;
+		return steps;
+	}
+
+	// fraction of a step between the previous and current simulation state
+	// ------------------------------------------------------------------------
+	float alpha() const { return (float)(accumulator / step); }
+
+	double getStep() const { return step; }
+	double getDroppedTime() const { return droppedTime; }
+
+private:
+	double step;
+	int maxSteps;
+	double accumulator;
+	double droppedTime;
+};
+#endif
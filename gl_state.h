@@ -0,0 +1,189 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+// Shadow of the GL state the renderer touches every frame. Each setter compares
+// against the last value it issued and skips the GL call when nothing changes,
+// counting issued and elided calls per frame. All calls must come from the
+// thread that owns the context; code that changes this state behind the
+// tracker's back (or deletes bound objects) must call invalidate().
+class GLState
+{
+public:
+	enum Call { USE_PROGRAM, BIND_VERTEX_ARRAY, ACTIVE_TEXTURE, BIND_TEXTURE, ENABLE, CLEAR_COLOR, UNIFORM, CALL_COUNT };
+
+	static const int MAX_TEXTURE_UNITS = 16;
+
+	struct Counters
+	{
+		unsigned int issued[CALL_COUNT] = {};
+		unsigned int elided[CALL_COUNT] = {};
+	};
+
+	static GLState& instance()
+	{
+		static GLState state;
+		return state;
+	}
+
+	void useProgram(GLuint program)
+	{
+		if (check(USE_PROGRAM, program == currentProgram))
+			return;
+		currentProgram = program;
+		glUseProgram(program);
+	}
+
+	void bindVertexArray(GLuint vao)
+	{
+		if (check(BIND_VERTEX_ARRAY, vao == currentVAO))
+			return;
+		currentVAO = vao;
+		glBindVertexArray(vao);
+	}
+
+	void activeTexture(GLenum unit)
+	{
+		if (check(ACTIVE_TEXTURE, unit == currentUnit))
+			return;
+		currentUnit = unit;
+		glActiveTexture(unit);
+	}
+
+	// binds texture to unit, switching the active unit only if the binding changes
+	// ------------------------------------------------------------------------
+	void bindTexture(GLenum unit, GLenum target, GLuint texture)
+	{
+		int slot = targetSlot(target);
+		int index = (int)(unit - GL_TEXTURE0);
+		if (slot < 0 || index < 0 || index >= MAX_TEXTURE_UNITS)
+		{
+			activeTexture(unit);
+			counters.issued[BIND_TEXTURE]++;
+			glBindTexture(target, texture);
+			return;
+		}
+		if (check(BIND_TEXTURE, textures[index][slot] == texture))
+			return;
+		activeTexture(unit);
+		textures[index][slot] = texture;
+		glBindTexture(target, texture);
+	}
+
+	// tracks GL_DEPTH_TEST, GL_BLEND and GL_CULL_FACE; other capabilities pass through
+	// ------------------------------------------------------------------------
+	void enable(GLenum capability)
+	{
+		signed char* flag = capabilityFlag(capability);
+		if (check(ENABLE, flag && *flag == 1))
+			return;
+		if (flag)
+			*flag = 1;
+		glEnable(capability);
+	}
+
+	void disable(GLenum capability)
+	{
+		signed char* flag = capabilityFlag(capability);
+		if (check(ENABLE, flag && *flag == 0))
+			return;
+		if (flag)
+			*flag = 0;
+		glDisable(capability);
+	}
+
+	void clearColor(float r, float g, float b, float a)
+	{
+		if (check(CLEAR_COLOR, r == clear[0] && g == clear[1] && b == clear[2] && a == clear[3]))
+			return;
+		clear[0] = r; clear[1] = g; clear[2] = b; clear[3] = a;
+		glClearColor(r, g, b, a);
+	}
+
+	// uniform values are per program, so Shader keeps their shadow copies; this
+	// only counts the outcome and returns true when the upload is redundant
+	// ------------------------------------------------------------------------
+	bool uniform(bool redundant) { return check(UNIFORM, redundant); }
+
+	// forgets everything so the next call of each kind is issued
+	// ------------------------------------------------------------------------
+	void invalidate()
+	{
+		currentProgram = INVALID;
+		currentVAO = INVALID;
+		currentUnit = INVALID;
+		for (int i = 0; i < MAX_TEXTURE_UNITS; ++i)
+			for (int j = 0; j < TARGET_COUNT; ++j)
+				textures[i][j] = INVALID;
+		depthTest = blend = cullFace = -1;
+		clear[0] = clear[1] = clear[2] = clear[3] = -1.0f;
+	}
+
+	// closes the frame's counters; getLastFrame() returns them until the next call
+	// ------------------------------------------------------------------------
+	void endFrame()
+	{
+		lastFrame = counters;
+		counters = Counters();
+	}
+
+	const Counters& getLastFrame() const { return lastFrame; }
+
+	void print(std::ostream& out) const
+	{
+		static const char* names[CALL_COUNT] = { "UseProgram", "BindVertexArray", "ActiveTexture", "BindTexture", "Enable", "ClearColor", "Uniform" };
+		out << "GL state calls last frame (issued/elided):";
+		for (int i = 0; i < CALL_COUNT; ++i)
+			out << " " << names[i] << " " << lastFrame.issued[i] << "/" << lastFrame.elided[i];
+		out << std::endl;
+	}
+
+private:
+	enum { TARGET_COUNT = 2 };
+	static const GLuint INVALID = 0xFFFFFFFFu;
+
+	GLState() { invalidate(); }
+
+	// counts the call and returns true when it is redundant
+	bool check(Call call, bool redundant)
+	{
+		if (redundant)
+			counters.elided[call]++;
+		else
+			counters.issued[call]++;
+		return redundant;
+	}
+
+	static int targetSlot(GLenum target)
+	{
+		if (target == GL_TEXTURE_2D)
+			return 0;
+		if (target == GL_TEXTURE_2D_ARRAY)
+			return 1;
+		return -1;
+	}
+
+	signed char* capabilityFlag(GLenum capability)
+	{
+		if (capability == GL_DEPTH_TEST)
+			return &depthTest;
+		if (capability == GL_BLEND)
+			return &blend;
+		if (capability == GL_CULL_FACE)
+			return &cullFace;
+		return nullptr;
+	}
+
+	GLuint currentProgram;
+	GLuint currentVAO;
+	GLenum currentUnit;
+	GLuint textures[MAX_TEXTURE_UNITS][TARGET_COUNT];
+	signed char depthTest, blend, cullFace;									// -1 unknown, 0 disabled, 1 enabled
+	float clear[4];
+	Counters counters;
+	Counters lastFrame;
+};
+#endif
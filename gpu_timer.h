@@ -0,0 +1,133 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+#include "profiler.h"
+
+#include <string>
+
+// GPU pass timer built on GL_TIMESTAMP queries. Every pass gets a start/end query
+// pair per frame slot, and slots rotate over FRAMES_IN_FLIGHT frames: a slot is
+// only read back when it is about to be reused, by which point the GPU has almost
+// always finished it. Results that are still not available are dropped rather than
+// waited on, so the CPU never stalls on the query. Each pass reports into a
+// Profiler zone called "GPU <name>" so GPU time sits next to the CPU zones.
+class GpuTimer
+{
+public:
+	static const int FRAMES_IN_FLIGHT = 3;
+	static const int MAX_PASSES = 16;
+
+	static GpuTimer& instance()
+	{
+		static GpuTimer timer;
+		return timer;
+	}
+
+	// creates the query pool; needs a current GL context
+	// ------------------------------------------------------------------------
+	void init()
+	{
+		glGenQueries(FRAMES_IN_FLIGHT * MAX_PASSES * 2, &queries[0][0][0]);
+		initialized = true;
+	}
+
+	void destroy()
+	{
+		if (!initialized)
+			return;
+		glDeleteQueries(FRAMES_IN_FLIGHT * MAX_PASSES * 2, &queries[0][0][0]);
+		initialized = false;
+	}
+
+	// returns the id of the pass called name, registering it on first use
+	// ------------------------------------------------------------------------
+	int pass(const char* name)
+	{
+		for (int i = 0; i < passCount; ++i)
+			if (passNames[i] == name)
+				return i;
+		if (passCount == MAX_PASSES)
+			return MAX_PASSES - 1;
+		passNames[passCount] = name;
+		profilerZones[passCount] = Profiler::instance().zone(("GPU " + passNames[passCount]).c_str());
+		return passCount++;
+	}
+
+	const std::string& passName(int id) const { return passNames[id]; }
+
+	void begin(int id)
+	{
+		if (!initialized)
+			return;
+		glQueryCounter(queries[frame][id][0], GL_TIMESTAMP);
+	}
+
+	void end(int id)
+	{
+		if (!initialized)
+			return;
+		glQueryCounter(queries[frame][id][1], GL_TIMESTAMP);
+		issued[frame][id] = true;
+	}
+
+	// advances to the next frame slot, first collecting whatever that slot measured
+	// FRAMES_IN_FLIGHT frames ago; call once per frame outside any GPU_ZONE
+	// ------------------------------------------------------------------------
+	void nextFrame()
+	{
+		if (!initialized)
+			return;
+		frame = (frame + 1) % FRAMES_IN_FLIGHT;
+		for (int id = 0; id < passCount; ++id)
+		{
+			if (!issued[frame][id])
+				continue;
+			issued[frame][id] = false;
+
+			GLint available = 0;
+			glGetQueryObjectiv(queries[frame][id][1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+			{
+				++dropped;
+				continue;
+			}
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(queries[frame][id][0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(queries[frame][id][1], GL_QUERY_RESULT, &end);
+			Profiler::instance().record(profilerZones[id], (end - start) / 1.0e6);
+		}
+	}
+
+	unsigned long long getDropped() const { return dropped; }
+
+private:
+	GpuTimer() : initialized(false), frame(0), passCount(0), dropped(0), queries(), issued() {}
+
+	bool initialized;
+	int frame;
+	int passCount;
+	unsigned long long dropped;												// results skipped because they were not ready
+	GLuint queries[FRAMES_IN_FLIGHT][MAX_PASSES][2];
+	bool issued[FRAMES_IN_FLIGHT][MAX_PASSES];
+	std::string passNames[MAX_PASSES];
+	int profilerZones[MAX_PASSES];
+};
+
+// brackets the enclosing scope with GPU timestamps
+// ------------------------------------------------------------------------
+class GpuScope
+{
+public:
+	explicit GpuScope(int passID) : id(passID) { GpuTimer::instance().begin(id); }
+	~GpuScope() { GpuTimer::instance().end(id); }
+
+private:
+	int id;
+};
+
+#define GPU_ZONE(name) \
+	static const int PROFILE_CONCAT(gpuPass, __LINE__) = GpuTimer::instance().pass(name); \
+	GpuScope PROFILE_CONCAT(gpuScope, __LINE__)(PROFILE_CONCAT(gpuPass, __LINE__))
+#endif
@@ -0,0 +1,179 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <cstdio>
+#include <iostream>
+
+#if defined(__linux__)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// Window-less GL context for render nodes without a display. On Linux it uses EGL:
+// the Mesa surfaceless platform when available (no X/Wayland/DRM device needed, so
+// llvmpipe works on plain CPU servers), otherwise the default EGL display. No EGL
+// surface is created; frames are drawn into an OffscreenFramebuffer instead.
+class HeadlessContext
+{
+public:
+	HeadlessContext() {}
+	~HeadlessContext() { destroy(); }
+
+	HeadlessContext(const HeadlessContext&) = delete;
+	HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+	// creates a core profile context of the given version and makes it current
+	// ------------------------------------------------------------------------
+	bool create(int major, int minor)
+	{
+#if defined(__linux__)
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+		EGLint eglMajor, eglMinor;
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &eglMajor, &eglMinor))
+		{
+			std::cout << "ERROR::HEADLESS::EGL_INITIALIZE_FAILED" << std::endl;
+			return false;
+		}
+		if (!eglBindAPI(EGL_OPENGL_API))
+		{
+			std::cout << "ERROR::HEADLESS::EGL_OPENGL_API_UNAVAILABLE" << std::endl;
+			return false;
+		}
+
+		// a config is optional with EGL_KHR_no_config_context; pick one if offered
+		const EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+		EGLConfig config = (EGLConfig)0;
+		EGLint configCount = 0;
+		eglChooseConfig(display, configAttribs, &config, 1, &configCount);
+
+		const EGLint contextAttribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, major,
+			EGL_CONTEXT_MINOR_VERSION, minor,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, configCount ? config : (EGLConfig)0, EGL_NO_CONTEXT, contextAttribs);
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		{
+			std::cout << "ERROR::HEADLESS::EGL_CONTEXT_FAILED 0x" << std::hex << eglGetError() << std::dec << std::endl;
+			return false;
+		}
+		return true;
+#else
+		(void)major; (void)minor;
+		std::cout << "ERROR::HEADLESS::NOT_SUPPORTED_ON_THIS_PLATFORM" << std::endl;
+		return false;
+#endif
+	}
+
+	void destroy()
+	{
+#if defined(__linux__)
+		if (display == EGL_NO_DISPLAY)
+			return;
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (context != EGL_NO_CONTEXT)
+			eglDestroyContext(display, context);
+		eglTerminate(display);
+		context = EGL_NO_CONTEXT;
+		display = EGL_NO_DISPLAY;
+#endif
+	}
+
+	// loader for gladLoadGLLoader
+	// ------------------------------------------------------------------------
+	static void* getProcAddress(const char* name)
+	{
+#if defined(__linux__)
+		return (void*)eglGetProcAddress(name);
+#else
+		(void)name;
+		return nullptr;
+#endif
+	}
+
+private:
+#if defined(__linux__)
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+// Color + depth render target of arbitrary size whose pixels can be read back to memory
+class OffscreenFramebuffer
+{
+public:
+	unsigned int FBO = 0;
+	int width = 0;
+	int height = 0;
+
+	bool create(int w, int h)
+	{
+		width = w;
+		height = h;
+		glGenFramebuffers(1, &FBO);
+		glGenRenderbuffers(2, renderbuffers);
+
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cout << "ERROR::FRAMEBUFFER::INCOMPLETE" << std::endl;
+			return false;
+		}
+		glViewport(0, 0, width, height);
+		return true;
+	}
+
+	void destroy()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &FBO);
+		glDeleteRenderbuffers(2, renderbuffers);
+		FBO = 0;
+	}
+
+	// copies the current color attachment into pixels as tightly packed RGBA, bottom row first
+	// ------------------------------------------------------------------------
+	void readPixels(std::vector<unsigned char>& pixels) const
+	{
+		pixels.resize((size_t)width * height * 4);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	}
+
+	// writes an RGBA frame from readPixels() as a binary PPM (top row first)
+	// ------------------------------------------------------------------------
+	static bool writePPM(const char* path, const std::vector<unsigned char>& pixels, int w, int h)
+	{
+		FILE* file = fopen(path, "wb");
+		if (!file)
+			return false;
+		fprintf(file, "P6\n%d %d\n255\n", w, h);
+		for (int y = h - 1; y >= 0; --y)
+			for (int x = 0; x < w; ++x)
+				fwrite(&pixels[((size_t)y * w + x) * 4], 1, 3, file);
+		fclose(file);
+		return true;
+	}
+
+private:
+	unsigned int renderbuffers[2] = { 0, 0 };
+};
+#endif
@@ -0,0 +1,380 @@
+#ifndef IMAGE_OPS_H
+#define IMAGE_OPS_H
+
+#include "cpu_features.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Pixel operations run on decoded images before upload: row flipping, channel
+// expansion and swizzles, alpha premultiplication and sRGB conversion. Every
+// operation works on stb_image buffers in place where the sizes allow it, and
+// picks the widest kernel the CPU supports at run time (AVX2, SSSE3 or SSE2,
+// else scalar); setIsa() narrows the choice, which the benchmarks use to
+// compare kernels. All kernels of one operation produce identical bytes.
+class ImageOps
+{
+public:
+	enum Isa { SCALAR, SSE2, SSSE3, AVX2 };
+
+	static Isa isa() { return active(); }
+
+	// narrows dispatch to at most isa; not for use while other threads run kernels
+	static void setIsa(Isa isa)
+	{
+		Isa supported = best();
+		active() = isa < supported ? isa : supported;
+	}
+
+	static Isa best()
+	{
+		const CpuFeatures& cpu = CpuFeatures::get();
+		return cpu.avx2 ? AVX2 : cpu.ssse3 ? SSSE3 : cpu.sse2 ? SSE2 : SCALAR;
+	}
+
+	static const char* nameOf(Isa isa)
+	{
+		return isa == AVX2 ? "AVX2" : isa == SSSE3 ? "SSSE3" : isa == SSE2 ? "SSE2" : "scalar";
+	}
+
+	// mirrors the image top to bottom
+	// ------------------------------------------------------------------------
+	static void flipVertical(unsigned char* image, int width, int height, int components)
+	{
+		size_t stride = (size_t)width * components;
+		for (int y = 0; y < height / 2; ++y)
+		{
+			unsigned char* top = image + (size_t)y * stride;
+			unsigned char* bottom = image + (size_t)(height - 1 - y) * stride;
+			size_t done = 0;
+#ifdef CPU_X86
+			if (active() >= AVX2)
+				done = swapAVX2(top, bottom, stride);
+			else if (active() >= SSE2)
+				done = swapSSE2(top, bottom, stride);
+#endif
+			for (size_t i = done; i < stride; ++i)
+			{
+				unsigned char t = top[i];
+				top[i] = bottom[i];
+				bottom[i] = t;
+			}
+		}
+	}
+
+	// reorders the channels of count RGBA pixels in place: channel c of the
+	// result is channel order[c] of the source, so { 2, 1, 0, 3 } turns RGBA
+	// into BGRA
+	// ------------------------------------------------------------------------
+	static void swizzle(unsigned char* pixels, size_t count, const int order[4])
+	{
+		size_t done = 0;
+#ifdef CPU_X86
+		if (active() >= AVX2)
+			done = swizzleAVX2(pixels, count, order);
+		else if (active() >= SSSE3)
+			done = swizzleSSSE3(pixels, count, order);
+#endif
+		for (size_t i = done; i < count; ++i)
+		{
+			unsigned char* p = pixels + i * 4;
+			unsigned char in[4] = { p[0], p[1], p[2], p[3] };
+			for (int c = 0; c < 4; ++c)
+				p[c] = in[order[c]];
+		}
+	}
+
+	// converts count pixels of from components to to components with the same
+	// rules as stb_image's req_comp: grey replicates into RGB, added alpha is
+	// 255, dropped colour becomes stb's luma. dst may be src when the buffer
+	// holds count * max(from, to) bytes; widening runs back to front for that.
+	// ------------------------------------------------------------------------
+	static void expand(const unsigned char* src, unsigned char* dst, size_t count, int from, int to)
+	{
+		if (from == to)
+		{
+			if (dst != src)
+				memmove(dst, src, count * from);
+			return;
+		}
+		if (to > from)
+		{
+			size_t simd = 0;
+#ifdef CPU_X86
+			if (from == 3 && to == 4 && active() >= SSSE3)
+				simd = rgbToRgbaSSSE3(src, dst, count);						// all pixels, or none if there are too few
+#endif
+			for (size_t i = count; i-- > simd;)
+				convertPixel(src + i * from, dst + i * to, from, to);
+			return;
+		}
+		for (size_t i = 0; i < count; ++i)
+			convertPixel(src + i * from, dst + i * to, from, to);
+	}
+
+	// scales colour by alpha in count RGBA pixels in place, rounding c * a / 255
+	// ------------------------------------------------------------------------
+	static void premultiplyAlpha(unsigned char* pixels, size_t count)
+	{
+		size_t done = 0;
+#ifdef CPU_X86
+		if (active() >= AVX2)
+			done = premultiplyAVX2(pixels, count);
+		else if (active() >= SSE2)
+			done = premultiplySSE2(pixels, count);
+#endif
+		for (size_t i = done; i < count; ++i)
+		{
+			unsigned char* p = pixels + i * 4;
+			for (int c = 0; c < 3; ++c)
+				p[c] = divide255(p[c] * p[3]);
+		}
+	}
+
+	// count sRGB-encoded bytes to linear floats; a table lookup, which no SIMD
+	// kernel beats without a gather
+	// ------------------------------------------------------------------------
+	static void srgbToLinear(const unsigned char* in, float* out, size_t count)
+	{
+		const float* table = srgbDecodeTable();
+		for (size_t i = 0; i < count; ++i)
+			out[i] = table[in[i]];
+	}
+
+	// count linear floats, clamped to [0, 1], to sRGB-encoded bytes
+	// ------------------------------------------------------------------------
+	static void linearToSrgb(const float* in, unsigned char* out, size_t count)
+	{
+		size_t done = 0;
+#ifdef CPU_X86
+		if (active() >= SSE2)
+			done = linearToSrgbSSE2(in, out, count);
+#endif
+		const unsigned char* table = srgbEncodeTable();
+		for (size_t i = done; i < count; ++i)
+		{
+			float v = in[i] < 0.0f ? 0.0f : in[i] > 1.0f ? 1.0f : in[i];
+			out[i] = table[(int)(v * SRGB_ENCODE_STEPS + 0.5f)];
+		}
+	}
+
+	// sRGB byte -> linear float
+	static const float* srgbDecodeTable()
+	{
+		static const std::vector<float> table = [] {
+			std::vector<float> t(256);
+			for (int i = 0; i < 256; ++i)
+			{
+				float c = i / 255.0f;
+				t[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+			return t;
+		}();
+		return table.data();
+	}
+
+	// linear float quantized to SRGB_ENCODE_STEPS -> sRGB byte; fine enough that
+	// the dark end, where sRGB is steepest, stays within one code
+	static const int SRGB_ENCODE_STEPS = 8191;
+	static const unsigned char* srgbEncodeTable()
+	{
+		static const std::vector<unsigned char> table = [] {
+			std::vector<unsigned char> t(SRGB_ENCODE_STEPS + 1);
+			for (int i = 0; i <= SRGB_ENCODE_STEPS; ++i)
+			{
+				float l = (float)i / SRGB_ENCODE_STEPS;
+				float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+				t[i] = (unsigned char)(c * 255.0f + 0.5f);
+			}
+			return t;
+		}();
+		return table.data();
+	}
+
+private:
+	static Isa& active()
+	{
+		static Isa isa = best();
+		return isa;
+	}
+
+	static unsigned char divide255(int v) { return (unsigned char)((v + 128 + ((v + 128) >> 8)) >> 8); }
+
+	static unsigned char luma(const unsigned char* p) { return (unsigned char)((p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8); }
+
+	// reads the whole source pixel before writing, so src and dst may overlap
+	static void convertPixel(const unsigned char* src, unsigned char* dst, int from, int to)
+	{
+		unsigned char grey = from >= 3 ? luma(src) : src[0];
+		unsigned char alpha = from == 2 ? src[1] : from == 4 ? src[3] : 255;
+		unsigned char r = from >= 3 ? src[0] : grey, g = from >= 3 ? src[1] : grey, b = from >= 3 ? src[2] : grey;
+		if (to <= 2)
+		{
+			dst[0] = grey;
+			if (to == 2)
+				dst[1] = alpha;
+		}
+		else
+		{
+			dst[0] = r;
+			dst[1] = g;
+			dst[2] = b;
+			if (to == 4)
+				dst[3] = alpha;
+		}
+	}
+
+#ifdef CPU_X86
+	CPU_TARGET_SSE2 static size_t swapSSE2(unsigned char* a, unsigned char* b, size_t bytes)
+	{
+		size_t i = 0;
+		for (; i + 16 <= bytes; i += 16)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)(a + i)), y = _mm_loadu_si128((const __m128i*)(b + i));
+			_mm_storeu_si128((__m128i*)(a + i), y);
+			_mm_storeu_si128((__m128i*)(b + i), x);
+		}
+		return i;
+	}
+
+	CPU_TARGET_AVX2 static size_t swapAVX2(unsigned char* a, unsigned char* b, size_t bytes)
+	{
+		size_t i = 0;
+		for (; i + 32 <= bytes; i += 32)
+		{
+			__m256i x = _mm256_loadu_si256((const __m256i*)(a + i)), y = _mm256_loadu_si256((const __m256i*)(b + i));
+			_mm256_storeu_si256((__m256i*)(a + i), y);
+			_mm256_storeu_si256((__m256i*)(b + i), x);
+		}
+		return i;
+	}
+
+	static void swizzleMask(const int order[4], unsigned char* mask)
+	{
+		for (int p = 0; p < 4; ++p)
+			for (int c = 0; c < 4; ++c)
+				mask[p * 4 + c] = (unsigned char)(p * 4 + order[c]);
+	}
+
+	CPU_TARGET_SSSE3 static size_t swizzleSSSE3(unsigned char* pixels, size_t count, const int order[4])
+	{
+		alignas(16) unsigned char bytes[16];
+		swizzleMask(order, bytes);
+		__m128i mask = _mm_load_si128((const __m128i*)bytes);
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i* p = (__m128i*)(pixels + i * 4);
+			_mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), mask));
+		}
+		return i;
+	}
+
+	CPU_TARGET_AVX2 static size_t swizzleAVX2(unsigned char* pixels, size_t count, const int order[4])
+	{
+		alignas(16) unsigned char bytes[16];
+		swizzleMask(order, bytes);
+		__m128i half = _mm_load_si128((const __m128i*)bytes);
+		__m256i mask = _mm256_broadcastsi128_si256(half);					// vpshufb works within each 128-bit lane
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i* p = (__m256i*)(pixels + i * 4);
+			_mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), mask));
+		}
+		return i;
+	}
+
+	// converts every pixel, the last few scalar and the rest four at a time,
+	// last group first. Each 16-byte load covers four pixels plus four bytes
+	// that are ignored; leaving the tail to scalar code keeps the loads inside
+	// the source, and going backwards keeps every load ahead of the stores when
+	// dst is src.
+	CPU_TARGET_SSSE3 static size_t rgbToRgbaSSSE3(const unsigned char* src, unsigned char* dst, size_t count)
+	{
+		if (count < 6)
+			return 0;
+		size_t n = (count - 2) / 4 * 4;
+		const __m128i mask = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+		for (size_t i = count; i-- > n;)
+			convertPixel(src + i * 3, dst + i * 4, 3, 4);
+		for (size_t i = n; i > 0;)
+		{
+			i -= 4;
+			__m128i rgb = _mm_loadu_si128((const __m128i*)(src + i * 3));
+			_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(rgb, mask), alpha));
+		}
+		return count;
+	}
+
+	// four pixels widened to 16 bits, times their own alpha (alpha lanes times 255)
+	CPU_TARGET_SSE2 static __m128i premultiplyHalf(__m128i wide, __m128i alphaLanes)
+	{
+		__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(wide, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		a = _mm_or_si128(_mm_andnot_si128(alphaLanes, a), _mm_and_si128(alphaLanes, _mm_set1_epi16(255)));
+		__m128i v = _mm_add_epi16(_mm_mullo_epi16(wide, a), _mm_set1_epi16(128));
+		return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+	}
+
+	CPU_TARGET_SSE2 static size_t premultiplySSE2(unsigned char* pixels, size_t count)
+	{
+		const __m128i alphaLanes = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+		const __m128i zero = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i* p = (__m128i*)(pixels + i * 4);
+			__m128i v = _mm_loadu_si128(p);
+			__m128i lo = premultiplyHalf(_mm_unpacklo_epi8(v, zero), alphaLanes);
+			__m128i hi = premultiplyHalf(_mm_unpackhi_epi8(v, zero), alphaLanes);
+			_mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+		}
+		return i;
+	}
+
+	CPU_TARGET_AVX2 static size_t premultiplyAVX2(unsigned char* pixels, size_t count)
+	{
+		const __m256i alphaLanes = _mm256_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1);
+		const __m256i zero = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i* p = (__m256i*)(pixels + i * 4);
+			__m256i v = _mm256_loadu_si256(p);
+			__m256i halves[2] = { _mm256_unpacklo_epi8(v, zero), _mm256_unpackhi_epi8(v, zero) };
+			for (int h = 0; h < 2; ++h)
+			{
+				__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(halves[h], _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+				a = _mm256_or_si256(_mm256_andnot_si256(alphaLanes, a), _mm256_and_si256(alphaLanes, _mm256_set1_epi16(255)));
+				__m256i m = _mm256_add_epi16(_mm256_mullo_epi16(halves[h], a), _mm256_set1_epi16(128));
+				halves[h] = _mm256_srli_epi16(_mm256_add_epi16(m, _mm256_srli_epi16(m, 8)), 8);
+			}
+			_mm256_storeu_si256(p, _mm256_packus_epi16(halves[0], halves[1]));	// unpack and pack both stay within lanes, so order survives
+		}
+		return i;
+	}
+
+	CPU_TARGET_SSE2 static size_t linearToSrgbSSE2(const float* in, unsigned char* out, size_t count)
+	{
+		const unsigned char* table = srgbEncodeTable();
+		const __m128 scale = _mm_set1_ps((float)SRGB_ENCODE_STEPS), half = _mm_set1_ps(0.5f);
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		alignas(16) int index[4];
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), zero), one);
+			_mm_store_si128((__m128i*)index, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), half)));
+			out[i + 0] = table[index[0]];
+			out[i + 1] = table[index[1]];
+			out[i + 2] = table[index[2]];
+			out[i + 3] = table[index[3]];
+		}
+		return i;
+	}
+#endif
+};
+#endif
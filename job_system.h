@@ -0,0 +1,455 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Counts unfinished jobs. run() increments it and the job decrements it when
+// done; wait() returns once it reaches zero. A job may also name a counter it
+// depends on and will not start until that counter is zero.
+struct JobCounter
+{
+	std::atomic<int> pending{ 0 };
+	bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+struct Job
+{
+	void (*function)(void* data, int begin, int end);
+	void* data;
+	int begin, end;
+	JobCounter* counter;												// decremented when the job finishes, may be null
+	const JobCounter* dependency;										// must reach zero before the job starts, may be null
+	std::atomic<bool> live{ false };									// queued or running; the record can't be reused yet
+	bool heap = false;													// overflow record, deleted when the job finishes
+};
+
+// Chase-Lev work-stealing deque of fixed capacity. The owning worker pushes and
+// pops at the bottom; any other thread steals from the top.
+class JobDeque
+{
+public:
+	static const int64_t CAPACITY = 4096;
+
+	bool push(Job* job)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		if (b - t >= CAPACITY)
+			return false;
+		items[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	Job* pop()
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+		if (t > b)
+		{
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		Job* job = items[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+		if (t == b)
+		{
+			// last item: race the thieves for it
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				job = nullptr;
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	Job* steal()
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return nullptr;
+		Job* job = items[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return nullptr;
+		return job;
+	}
+
+private:
+	alignas(64) std::atomic<int64_t> top{ 0 };
+	alignas(64) std::atomic<int64_t> bottom{ 0 };
+	std::atomic<Job*> items[CAPACITY];
+};
+
+// Work-stealing thread pool. Each worker owns a JobDeque; threads that are not
+// workers (main, render) submit into a shared injection queue instead. Idle
+// workers take from their own deque, then the injection queue, then steal from a
+// random other worker, and sleep briefly when everything is empty. wait() never
+// just blocks: the waiting thread runs jobs until its counter reaches zero, so a
+// job can wait on jobs it spawned.
+class JobSystem
+{
+public:
+	static const int MAX_WORKERS = 256;
+	static const int JOBS_PER_THREAD = 4096;							// ring of Job records per submitting thread, heap beyond that
+
+	struct WorkerStats
+	{
+		unsigned long long jobs = 0;
+		unsigned long long steals = 0;
+		double busyMilliseconds = 0.0;
+		double idleMilliseconds = 0.0;
+	};
+
+	static JobSystem& instance()
+	{
+		static JobSystem system;
+		return system;
+	}
+
+	// workers < 0 uses one per hardware thread minus the caller's; pinning puts
+	// worker i on core (i + 1) so core 0 stays with the render thread
+	// ------------------------------------------------------------------------
+	void init(int workers, bool pin)
+	{
+		int cores = (int)std::thread::hardware_concurrency();
+		if (workers < 0)
+			workers = cores > 1 ? cores - 1 : 0;
+		if (workers > MAX_WORKERS)
+			workers = MAX_WORKERS;
+		running.store(true);
+		startTime = std::chrono::steady_clock::now();
+		for (int i = 0; i < workers; ++i)
+			states.emplace_back(new WorkerState());
+		for (int i = 0; i < workers; ++i)
+		{
+			threads.emplace_back(&JobSystem::workerLoop, this, i);
+			if (pin && cores > 0)
+				pinThread(threads.back(), (i + 1) % cores);
+		}
+	}
+
+	// joins the workers; init() may be called again afterwards
+	// ------------------------------------------------------------------------
+	void shutdown()
+	{
+		running.store(false);
+		sleepCondition.notify_all();
+		for (size_t i = 0; i < threads.size(); ++i)
+			threads[i].join();
+		stopTime = std::chrono::steady_clock::now();
+		threads.clear();
+		states.clear();
+	}
+
+	int getWorkerCount() const { return (int)states.size(); }
+
+	// queues function(data, begin, end); counter (if any) is incremented now and
+	// decremented when the job finishes. Without workers the job runs right here
+	// unless its dependency is still pending
+	// ------------------------------------------------------------------------
+	void run(void (*function)(void*, int, int), void* data, int begin, int end,
+		JobCounter* counter = nullptr, const JobCounter* dependency = nullptr)
+	{
+		Job* job = allocate();
+		job->function = function;
+		job->data = data;
+		job->begin = begin;
+		job->end = end;
+		job->counter = counter;
+		job->dependency = dependency;
+		if (counter)
+			counter->pending.fetch_add(1, std::memory_order_relaxed);
+		if (states.empty() && (!dependency || dependency->done()))
+			execute(job, -1);
+		else
+			enqueue(job);
+	}
+
+	// runs jobs on the calling thread until counter reaches zero
+	// ------------------------------------------------------------------------
+	void wait(const JobCounter& counter)
+	{
+		while (!counter.done())
+		{
+			if (!runOne())
+				std::this_thread::yield();
+		}
+	}
+
+	// splits [begin, end) into chunks of at least grain and calls body(b, e) for
+	// each on the pool, returning when all are done; body runs concurrently
+	// ------------------------------------------------------------------------
+	template <typename Body>
+	void parallelFor(int begin, int end, int grain, const Body& body)
+	{
+		if (end <= begin)
+			return;
+		int chunks = (getWorkerCount() + 1) * 4;						// a few chunks per thread so stealing can balance
+		int size = (end - begin + chunks - 1) / chunks;
+		if (size < grain)
+			size = grain;
+		if (size >= end - begin)
+		{
+			body(begin, end);
+			return;
+		}
+
+		JobCounter counter;
+		for (int b = begin; b < end; b += size)
+		{
+			int e = end - b > size ? b + size : end;
+			run([](void* data, int first, int last) { (*(const Body*)data)(first, last); }, (void*)&body, b, e, &counter);
+		}
+		wait(counter);
+	}
+
+	// per-worker totals; idle time is wall time since init() minus busy time
+	// ------------------------------------------------------------------------
+	std::vector<WorkerStats> getStats() const
+	{
+		auto end = threads.empty() && !running.load() ? stopTime : std::chrono::steady_clock::now();
+		double alive = std::chrono::duration<double, std::milli>(end - startTime).count();
+		std::vector<WorkerStats> result(states.size());
+		for (size_t i = 0; i < states.size(); ++i)
+		{
+			result[i].jobs = states[i]->jobs.load(std::memory_order_relaxed);
+			result[i].steals = states[i]->steals.load(std::memory_order_relaxed);
+			result[i].busyMilliseconds = states[i]->busyNanoseconds.load(std::memory_order_relaxed) / 1e6;
+			result[i].idleMilliseconds = alive - result[i].busyMilliseconds;
+		}
+		return result;
+	}
+
+	void print(std::ostream& out) const
+	{
+		std::vector<WorkerStats> stats = getStats();
+		out << "Job system: " << stats.size() << " workers, " << overflowJobs.load(std::memory_order_relaxed)
+			<< " jobs heap-allocated (record ring full)" << std::endl;
+		out << std::fixed << std::setprecision(3);
+		for (size_t i = 0; i < stats.size(); ++i)
+		{
+			double total = stats[i].busyMilliseconds + stats[i].idleMilliseconds;
+			out << "  worker " << std::setw(3) << i << "  jobs " << std::setw(8) << stats[i].jobs
+				<< "  steals " << std::setw(8) << stats[i].steals
+				<< "  busy " << std::setw(10) << stats[i].busyMilliseconds << " ms"
+				<< "  idle " << std::setw(10) << stats[i].idleMilliseconds << " ms"
+				<< "  (" << std::setprecision(1) << (total > 0.0 ? 100.0 * stats[i].busyMilliseconds / total : 0.0)
+				<< "% busy)" << std::setprecision(3) << std::endl;
+		}
+		out.unsetf(std::ios::floatfield);
+	}
+
+private:
+	struct WorkerState
+	{
+		JobDeque deque;
+		alignas(64) std::atomic<unsigned long long> jobs{ 0 };
+		std::atomic<unsigned long long> steals{ 0 };
+		std::atomic<long long> busyNanoseconds{ 0 };
+	};
+
+	JobSystem() {}
+	~JobSystem()
+	{
+		if (!threads.empty())
+			shutdown();
+	}
+
+	// index of the calling worker, -1 on other threads
+	static int& workerIndex()
+	{
+		static thread_local int index = -1;
+		return index;
+	}
+
+	// Job records come from a per-thread ring. A thread with more than
+	// JOBS_PER_THREAD jobs outstanding wraps onto records still in flight; those
+	// are left alone and the job gets a heap record instead
+	Job* allocate()
+	{
+		static thread_local std::unique_ptr<Job[]> pool(new Job[JOBS_PER_THREAD]);
+		static thread_local unsigned int next = 0;
+		Job* job = &pool[next++ % JOBS_PER_THREAD];
+		if (job->live.load(std::memory_order_acquire))
+		{
+			job = new Job();
+			job->heap = true;
+			overflowJobs.fetch_add(1, std::memory_order_relaxed);
+		}
+		job->live.store(true, std::memory_order_relaxed);
+		return job;
+	}
+
+	void enqueue(Job* job)
+	{
+		int index = workerIndex();
+		if (index < 0 || !states[index]->deque.push(job))
+		{
+			std::lock_guard<std::mutex> lock(injectionMutex);
+			injection.push_back(job);
+		}
+		if (sleeping.load(std::memory_order_relaxed) > 0)
+			sleepCondition.notify_one();
+	}
+
+	// parks a job whose dependency is pending at the back of the injection
+	// queue; pushed back on the worker's own deque it would be the next pop,
+	// and the worker would spin on it while the job it waits for sits beneath
+	void defer(Job* job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(injectionMutex);
+			injection.push_back(job);
+		}
+		if (sleeping.load(std::memory_order_relaxed) > 0)
+			sleepCondition.notify_one();
+	}
+
+	Job* find(int index)
+	{
+		if (index >= 0)
+		{
+			if (Job* job = states[index]->deque.pop())
+				return job;
+		}
+		{
+			std::lock_guard<std::mutex> lock(injectionMutex);
+			if (!injection.empty())
+			{
+				Job* job = injection.front();
+				injection.pop_front();
+				return job;
+			}
+		}
+		int count = (int)states.size();
+		if (count == 0)
+			return nullptr;
+		static thread_local unsigned int seed = 2463534242u;
+		seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;	// xorshift victim choice
+		int start = (int)(seed % (unsigned int)count);
+		for (int i = 0; i < count; ++i)
+		{
+			int victim = (start + i) % count;
+			if (victim == index)
+				continue;
+			if (Job* job = states[victim]->deque.steal())
+			{
+				if (index >= 0)
+					states[index]->steals.fetch_add(1, std::memory_order_relaxed);
+				return job;
+			}
+		}
+		return nullptr;
+	}
+
+	// runs one available job; false if there was none ready
+	bool runOne()
+	{
+		int index = workerIndex();
+		Job* job = find(index);
+		if (!job)
+			return false;
+		if (job->dependency && !job->dependency->done())
+		{
+			defer(job);
+			return false;
+		}
+		execute(job, index);
+		return true;
+	}
+
+	void execute(Job* job, int index)
+	{
+		auto start = std::chrono::steady_clock::now();
+		job->function(job->data, job->begin, job->end);
+		if (index >= 0)
+		{
+			long long elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			states[index]->busyNanoseconds.fetch_add(elapsed, std::memory_order_relaxed);
+			states[index]->jobs.fetch_add(1, std::memory_order_relaxed);
+		}
+		if (job->counter)
+			job->counter->pending.fetch_sub(1, std::memory_order_release);
+		if (job->heap)
+			delete job;
+		else
+			job->live.store(false, std::memory_order_release);			// the submitting thread may reuse it now
+	}
+
+	void workerLoop(int index)
+	{
+		workerIndex() = index;
+		int misses = 0;
+		while (running.load(std::memory_order_relaxed))
+		{
+			if (runOne())
+			{
+				misses = 0;
+				continue;
+			}
+			if (++misses < 64)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			// nothing to do for a while: sleep until a submit or a short timeout
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			sleeping.fetch_add(1, std::memory_order_relaxed);
+			sleepCondition.wait_for(lock, std::chrono::milliseconds(1));
+			sleeping.fetch_sub(1, std::memory_order_relaxed);
+			misses = 0;
+		}
+	}
+
+	static void pinThread(std::thread& thread, int core)
+	{
+#if defined(_WIN32)
+		SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << (core % 64));
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+		(void)thread; (void)core;
+#endif
+	}
+
+	std::vector<std::unique_ptr<WorkerState>> states;
+	std::vector<std::thread> threads;
+	std::atomic<bool> running{ false };
+	std::mutex injectionMutex;
+	std::deque<Job*> injection;
+	std::mutex sleepMutex;
+	std::condition_variable sleepCondition;
+	std::atomic<int> sleeping{ 0 };
+	std::atomic<unsigned long long> overflowJobs{ 0 };
+	std::chrono::steady_clock::time_point startTime, stopTime;
+};
+#endif
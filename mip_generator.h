@@ -0,0 +1,267 @@
+#ifndef MIP_GENERATOR_H
+#define MIP_GENERATOR_H
+
+#include "job_system.h"
+#include "image_ops.h"
+
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_GENERATOR_SSE2
+#include <emmintrin.h>
+#endif
+
+// Builds a texture's mip chain on the CPU so it can be uploaded level by level
+// instead of running glGenerateMipmap on the render thread. Each level is
+// filtered from the one above it in floating point, one RGBA float quad per
+// pixel so a whole pixel is one SSE register, with rows spread over the job
+// system. Colour channels of 3 and 4 component images are averaged in linear
+// light and re-encoded as sRGB unless Options::srgb is cleared; 1 and 2
+// component images are treated as data. With an alpha cutoff set, each level's
+// alpha is rescaled so the fraction of texels passing the cutoff matches the
+// base image, which keeps alpha-tested edges from thinning out with distance.
+class MipGenerator
+{
+public:
+	enum Filter { BOX, KAISER };
+
+	struct Options
+	{
+		Filter filter = BOX;
+		bool srgb = true;
+		float alphaCutoff = -1.0f;											// 0..1, negative leaves alpha as filtered
+	};
+
+	struct Level
+	{
+		int width = 0, height = 0;
+		std::vector<unsigned char> pixels;									// tightly packed, same component count as the source
+	};
+
+	// levels 1 and below of a width x height image, down to 1x1; level sizes
+	// follow GL, halving and rounding down
+	// ------------------------------------------------------------------------
+	static std::vector<Level> build(const unsigned char* pixels, int width, int height, int components, const Options& options)
+	{
+		std::vector<Level> levels;
+		bool srgb = options.srgb && components >= 3;
+		bool coverage = options.alphaCutoff >= 0.0f && components == 4;
+
+		std::vector<float> source = toFloat(pixels, width, height, components, srgb);
+		float baseCoverage = coverage ? alphaCoverage(source, 1.0f, options.alphaCutoff) : 0.0f;
+		while (width > 1 || height > 1)
+		{
+			int nextWidth = width > 1 ? width / 2 : 1, nextHeight = height > 1 ? height / 2 : 1;
+			std::vector<float> next = options.filter == KAISER ? kaiser(source, width, height, nextWidth, nextHeight)
+				: box(source, width, height, nextWidth, nextHeight);
+
+			Level level;
+			level.width = nextWidth;
+			level.height = nextHeight;
+			float alphaScale = coverage ? coverageScale(next, baseCoverage, options.alphaCutoff) : 1.0f;
+			level.pixels = toBytes(next, nextWidth, nextHeight, components, srgb, alphaScale);
+			levels.push_back(std::move(level));
+
+			source.swap(next);
+			width = nextWidth;
+			height = nextHeight;
+		}
+		return levels;
+	}
+
+private:
+	static std::vector<float> toFloat(const unsigned char* pixels, int width, int height, int components, bool srgb)
+	{
+		std::vector<float> out((size_t)width * height * 4);
+		const float* decode = ImageOps::srgbDecodeTable();
+		JobSystem::instance().parallelFor(0, height, 16, [&](int begin, int end) {
+			for (int y = begin; y < end; ++y)
+			{
+				const unsigned char* in = pixels + (size_t)y * width * components;
+				float* row = &out[(size_t)y * width * 4];
+				for (int x = 0; x < width; ++x, in += components, row += 4)
+				{
+					for (int c = 0; c < 4; ++c)
+					{
+						if (c >= components)
+							row[c] = c == 3 ? 1.0f : 0.0f;
+						else if (srgb && c < 3)
+							row[c] = decode[in[c]];
+						else
+							row[c] = in[c] / 255.0f;
+					}
+				}
+			}
+		});
+		return out;
+	}
+
+	static std::vector<unsigned char> toBytes(const std::vector<float>& pixels, int width, int height, int components, bool srgb, float alphaScale)
+	{
+		std::vector<unsigned char> out((size_t)width * height * components);
+		const unsigned char* encode = ImageOps::srgbEncodeTable();
+		JobSystem::instance().parallelFor(0, height, 16, [&](int begin, int end) {
+			for (int y = begin; y < end; ++y)
+			{
+				const float* in = &pixels[(size_t)y * width * 4];
+				unsigned char* row = &out[(size_t)y * width * components];
+				for (int x = 0; x < width; ++x, in += 4, row += components)
+				{
+					for (int c = 0; c < components; ++c)
+					{
+						float v = c == 3 ? in[c] * alphaScale : in[c];
+						v = v < 0.0f ? 0.0f : v > 1.0f ? 1.0f : v;
+						row[c] = srgb && c < 3 ? encode[(int)(v * ImageOps::SRGB_ENCODE_STEPS + 0.5f)] : (unsigned char)(v * 255.0f + 0.5f);
+					}
+				}
+			}
+		});
+		return out;
+	}
+
+	// 2x2 average; the last row or column of an odd-sized level does not contribute
+	static std::vector<float> box(const std::vector<float>& src, int width, int height, int nextWidth, int nextHeight)
+	{
+		std::vector<float> dst((size_t)nextWidth * nextHeight * 4);
+		JobSystem::instance().parallelFor(0, nextHeight, 16, [&](int begin, int end) {
+			for (int y = begin; y < end; ++y)
+			{
+				int y0 = y * 2 < height ? y * 2 : height - 1, y1 = y * 2 + 1 < height ? y * 2 + 1 : height - 1;
+				const float* row0 = &src[(size_t)y0 * width * 4];
+				const float* row1 = &src[(size_t)y1 * width * 4];
+				float* out = &dst[(size_t)y * nextWidth * 4];
+				for (int x = 0; x < nextWidth; ++x, out += 4)
+				{
+					int x0 = x * 2 < width ? x * 2 : width - 1, x1 = x * 2 + 1 < width ? x * 2 + 1 : width - 1;
+#ifdef MIP_GENERATOR_SSE2
+					__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0 * 4), _mm_loadu_ps(row0 + x1 * 4)),
+						_mm_add_ps(_mm_loadu_ps(row1 + x0 * 4), _mm_loadu_ps(row1 + x1 * 4)));
+					_mm_storeu_ps(out, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+					for (int c = 0; c < 4; ++c)
+						out[c] = (row0[x0 * 4 + c] + row0[x1 * 4 + c] + row1[x0 * 4 + c] + row1[x1 * 4 + c]) * 0.25f;
+#endif
+				}
+			}
+		});
+		return dst;
+	}
+
+	// Kaiser-windowed sinc over 8 taps per axis, applied as two separable passes;
+	// sharper than the box at the cost of slight ringing, which is clamped
+	static const int KAISER_TAPS = 8;
+	static const float* kaiserWeights()
+	{
+		static const std::vector<float> weights = [] {
+			// taps sit at -3.5 .. 3.5 source texels from the destination texel's centre
+			const double alpha = 4.0, radius = KAISER_TAPS / 2;
+			std::vector<float> w(KAISER_TAPS);
+			double sum = 0.0;
+			for (int i = 0; i < KAISER_TAPS; ++i)
+			{
+				double d = i - (KAISER_TAPS - 1) / 2.0;
+				double x = d / 2.0;											// sinc at the destination's sample rate
+				double sinc = x == 0.0 ? 1.0 : std::sin(3.14159265358979 * x) / (3.14159265358979 * x);
+				double t = d / radius;
+				double window = besselI0(alpha * std::sqrt(1.0 - t * t)) / besselI0(alpha);
+				w[i] = (float)(sinc * window);
+				sum += w[i];
+			}
+			for (int i = 0; i < KAISER_TAPS; ++i)
+				w[i] = (float)(w[i] / sum);
+			return w;
+		}();
+		return weights.data();
+	}
+
+	static double besselI0(double x)
+	{
+		double sum = 1.0, term = 1.0;
+		for (int k = 1; k < 20; ++k)
+		{
+			term *= (x / (2.0 * k)) * (x / (2.0 * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	static std::vector<float> kaiser(const std::vector<float>& src, int width, int height, int nextWidth, int nextHeight)
+	{
+		const float* weights = kaiserWeights();
+		const int first = -(KAISER_TAPS / 2 - 1);							// tap 0 reads source texel 2x + first
+
+		std::vector<float> horizontal((size_t)nextWidth * height * 4);
+		JobSystem::instance().parallelFor(0, height, 16, [&](int begin, int end) {
+			for (int y = begin; y < end; ++y)
+			{
+				const float* row = &src[(size_t)y * width * 4];
+				float* out = &horizontal[(size_t)y * nextWidth * 4];
+				for (int x = 0; x < nextWidth; ++x, out += 4)
+					filterTaps(row, 4, width, x * 2 + first, weights, out);
+			}
+		});
+
+		std::vector<float> dst((size_t)nextWidth * nextHeight * 4);
+		JobSystem::instance().parallelFor(0, nextHeight, 16, [&](int begin, int end) {
+			for (int y = begin; y < end; ++y)
+			{
+				float* out = &dst[(size_t)y * nextWidth * 4];
+				for (int x = 0; x < nextWidth; ++x, out += 4)
+					filterTaps(&horizontal[(size_t)x * 4], (size_t)nextWidth * 4, height, y * 2 + first, weights, out);
+			}
+		});
+		return dst;
+	}
+
+	// weighted sum of KAISER_TAPS texels stride floats apart starting at index
+	// start, clamped to [0, count), written clamped to [0, 1]
+	static void filterTaps(const float* base, size_t stride, int count, int start, const float* weights, float* out)
+	{
+#ifdef MIP_GENERATOR_SSE2
+		__m128 sum = _mm_setzero_ps();
+		for (int i = 0; i < KAISER_TAPS; ++i)
+		{
+			int s = start + i < 0 ? 0 : start + i >= count ? count - 1 : start + i;
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(base + s * stride), _mm_set1_ps(weights[i])));
+		}
+		_mm_storeu_ps(out, _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(1.0f)));
+#else
+		float sum[4] = {};
+		for (int i = 0; i < KAISER_TAPS; ++i)
+		{
+			int s = start + i < 0 ? 0 : start + i >= count ? count - 1 : start + i;
+			for (int c = 0; c < 4; ++c)
+				sum[c] += base[s * stride + c] * weights[i];
+		}
+		for (int c = 0; c < 4; ++c)
+			out[c] = sum[c] < 0.0f ? 0.0f : sum[c] > 1.0f ? 1.0f : sum[c];
+#endif
+	}
+
+	// fraction of texels whose scaled alpha reaches cutoff
+	static float alphaCoverage(const std::vector<float>& pixels, float scale, float cutoff)
+	{
+		size_t count = pixels.size() / 4, passing = 0;
+		for (size_t i = 0; i < count; ++i)
+			if (pixels[i * 4 + 3] * scale >= cutoff)
+				++passing;
+		return count ? (float)passing / count : 0.0f;
+	}
+
+	// alpha scale that brings a level's coverage closest to target, by bisection
+	static float coverageScale(const std::vector<float>& pixels, float target, float cutoff)
+	{
+		float low = 0.0f, high = 4.0f, scale = 1.0f;
+		for (int i = 0; i < 12; ++i)
+		{
+			scale = (low + high) * 0.5f;
+			if (alphaCoverage(pixels, scale, cutoff) < target)
+				low = scale;
+			else
+				high = scale;
+		}
+		return scale;
+	}
+};
+#endif
@@ -0,0 +1,217 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+// CPU frame profiler. Each named zone owns a fixed-size ring of the most recent
+// samples (in milliseconds); the thread timing a zone is the only writer and the
+// dump path only reads, so recording is a couple of relaxed stores and never locks.
+class Profiler
+{
+public:
+	static const int MAX_ZONES = 64;
+	static const int RING_SIZE = 4096;										// samples kept per zone
+	static const int HISTOGRAM_BUCKETS = 12;
+
+	struct ZoneStats
+	{
+		std::string name;
+		unsigned long long count = 0;										// samples recorded since startup
+		int window = 0;														// samples the statistics below cover
+		double mean = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0, max = 0.0;
+		unsigned int histogram[HISTOGRAM_BUCKETS] = {};
+	};
+
+	static Profiler& instance()
+	{
+		static Profiler profiler;
+		return profiler;
+	}
+
+	// returns the id of the zone called name, registering it on first use
+	// ------------------------------------------------------------------------
+	int zone(const char* name)
+	{
+		std::lock_guard<std::mutex> lock(registerMutex);
+		int count = zoneCount.load(std::memory_order_acquire);
+		for (int i = 0; i < count; ++i)
+			if (zones[i].name == name)
+				return i;
+		if (count == MAX_ZONES)
+			return MAX_ZONES - 1;
+		zones[count].name = name;
+		zoneCount.store(count + 1, std::memory_order_release);
+		return count;
+	}
+
+	void record(int id, double milliseconds)
+	{
+		Zone& z = zones[id];
+		unsigned long long index = z.written.load(std::memory_order_relaxed);
+		z.samples[index % RING_SIZE].store((float)milliseconds, std::memory_order_relaxed);
+		z.written.store(index + 1, std::memory_order_release);
+	}
+
+	// computes percentiles over the samples currently held in a zone's ring
+	// ------------------------------------------------------------------------
+	ZoneStats stats(int id) const
+	{
+		const Zone& z = zones[id];
+		ZoneStats result;
+		result.name = z.name;
+		result.count = z.written.load(std::memory_order_acquire);
+		result.window = (int)std::min<unsigned long long>(result.count, RING_SIZE);
+		if (result.window == 0)
+			return result;
+
+		std::vector<float> sorted(result.window);
+		double sum = 0.0;
+		for (int i = 0; i < result.window; ++i)
+		{
+			sorted[i] = z.samples[i].load(std::memory_order_relaxed);
+			sum += sorted[i];
+			++result.histogram[bucket(sorted[i])];
+		}
+		std::sort(sorted.begin(), sorted.end());
+
+		result.mean = sum / result.window;
+		result.p50 = percentile(sorted, 0.50);
+		result.p95 = percentile(sorted, 0.95);
+		result.p99 = percentile(sorted, 0.99);
+		result.max = sorted.back();
+		return result;
+	}
+
+	int getZoneCount() const { return zoneCount.load(std::memory_order_acquire); }
+
+	// upper edge (ms) of each histogram bucket; the last bucket is unbounded
+	// ------------------------------------------------------------------------
+	static double bucketEdge(int i)
+	{
+		static const double edges[HISTOGRAM_BUCKETS] = { 0.05, 0.1, 0.25, 0.5, 1.0, 2.0, 4.0, 8.0, 16.7, 33.3, 66.7, 1e30 };
+		return edges[i];
+	}
+
+	bool dumpCSV(const char* path) const
+	{
+		std::ofstream out(path);
+		if (!out)
+			return false;
+		out << "zone,count,window,mean_ms,p50_ms,p95_ms,p99_ms,max_ms";
+		for (int b = 0; b < HISTOGRAM_BUCKETS - 1; ++b)
+			out << ",le_" << bucketEdge(b);
+		out << ",le_inf\n";
+		for (int i = 0; i < getZoneCount(); ++i)
+		{
+			ZoneStats s = stats(i);
+			out << s.name << "," << s.count << "," << s.window << "," << s.mean << "," << s.p50 << ","
+				<< s.p95 << "," << s.p99 << "," << s.max;
+			for (int b = 0; b < HISTOGRAM_BUCKETS; ++b)
+				out << "," << s.histogram[b];
+			out << "\n";
+		}
+		return true;
+	}
+
+	bool dumpJSON(const char* path) const
+	{
+		std::ofstream out(path);
+		if (!out)
+			return false;
+		out << "{\n  \"bucket_edges_ms\": [";
+		for (int b = 0; b < HISTOGRAM_BUCKETS - 1; ++b)
+			out << (b ? ", " : "") << bucketEdge(b);
+		out << "],\n  \"zones\": [\n";
+		for (int i = 0; i < getZoneCount(); ++i)
+		{
+			ZoneStats s = stats(i);
+			out << "    { \"name\": \"" << s.name << "\", \"count\": " << s.count << ", \"window\": " << s.window
+				<< ", \"mean_ms\": " << s.mean << ", \"p50_ms\": " << s.p50 << ", \"p95_ms\": " << s.p95
+				<< ", \"p99_ms\": " << s.p99 << ", \"max_ms\": " << s.max << ", \"histogram\": [";
+			for (int b = 0; b < HISTOGRAM_BUCKETS; ++b)
+				out << (b ? ", " : "") << s.histogram[b];
+			out << "] }" << (i + 1 < getZoneCount() ? "," : "") << "\n";
+		}
+		out << "  ]\n}\n";
+		return true;
+	}
+
+	void print(std::ostream& out) const
+	{
+		out << "Profiler (ms)             p50      p95      p99      max" << std::endl;
+		for (int i = 0; i < getZoneCount(); ++i)
+		{
+			ZoneStats s = stats(i);
+			char line[128];
+			snprintf(line, sizeof(line), "  %-22s %8.3f %8.3f %8.3f %8.3f", s.name.c_str(), s.p50, s.p95, s.p99, s.max);
+			out << line << std::endl;
+		}
+	}
+
+	// async-signal-safe: only raises a flag the frame loop polls
+	// ------------------------------------------------------------------------
+	void requestDump() { dumpPending.store(true, std::memory_order_relaxed); }
+	bool consumeDumpRequest() { return dumpPending.exchange(false, std::memory_order_relaxed); }
+
+private:
+	struct Zone
+	{
+		std::string name;
+		std::atomic<unsigned long long> written{ 0 };
+		std::atomic<float> samples[RING_SIZE];
+	};
+
+	Profiler() : zones(new Zone[MAX_ZONES]) {}
+	~Profiler() { delete[] zones; }
+
+	static int bucket(float milliseconds)
+	{
+		int b = 0;
+		while (b < HISTOGRAM_BUCKETS - 1 && milliseconds > bucketEdge(b))
+			++b;
+		return b;
+	}
+
+	static double percentile(const std::vector<float>& sorted, double p)
+	{
+		size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+		return sorted[index];
+	}
+
+	Zone* zones;
+	std::mutex registerMutex;												// only taken when a zone is first registered
+	std::atomic<int> zoneCount{ 0 };
+	std::atomic<bool> dumpPending{ false };
+};
+
+// times the enclosing scope into a profiler zone
+// ------------------------------------------------------------------------
+class ProfileScope
+{
+public:
+	explicit ProfileScope(int zoneID) : id(zoneID), start(std::chrono::steady_clock::now()) {}
+	~ProfileScope()
+	{
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		Profiler::instance().record(id, elapsed.count());
+	}
+
+private:
+	int id;
+	std::chrono::steady_clock::time_point start;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) \
+	static const int PROFILE_CONCAT(profileZone, __LINE__) = Profiler::instance().zone(name); \
+	ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileZone, __LINE__))
+#endif
@@ -0,0 +1,273 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "gpu_timer.h"
+#include "profiler.h"
+#include "gl_state.h"
+#include "ring_buffer.h"
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+// Per-frame draw queue. Each submitted draw gets a 64-bit sort key
+//
+//   bits 63..48  program      bits 47..32  vertex array
+//   bits 31..16  material     bits 15..0   depth (front to back)
+//
+// so after an LSD radix sort draws sharing a program, VAO and material are
+// adjacent and execute() only requests state changes between groups. Keys only
+// order the draws; the comparisons in execute() and GLState use the real GL
+// names, so two objects that alias in 16 key bits still bind correctly.
+//
+// Each draw's model matrix and its material's texture array layers are written
+// into the ring buffer at submit() and bound to the std140 block "Draw" at
+// DRAW_BLOCK_BINDING just before the draw.
+//
+// Material texture binds are timed into the CPU zone "TextureBind", and a draw
+// with a GPU pass is also timed on the CPU into a zone of the pass's name.
+class RenderQueue
+{
+public:
+	static const int MAX_TEXTURE_UNITS = 4;
+	static const GLuint DRAW_BLOCK_BINDING = 0;
+
+	struct Material
+	{
+		GLenum target;														// GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+		GLuint textures[MAX_TEXTURE_UNITS];									// bound to GL_TEXTURE0 + i, 0 = unused
+		int layers[MAX_TEXTURE_UNITS];										// array layer sampled through unit i
+	};
+
+	// std140 "Draw" block: mat4 model; ivec4 layers
+	struct DrawBlock
+	{
+		glm::mat4 model;
+		int layers[MAX_TEXTURE_UNITS];
+	};
+	static_assert(sizeof(DrawBlock) == 80, "DrawBlock does not match std140");
+
+	struct Draw
+	{
+		uint64_t key;
+		Shader* shader;
+		GLuint vao;
+		int material;														// index from addMaterial(), -1 for none
+		GLint first;
+		GLsizei count;
+		GLsizei instances;													// > 1 draws instanced from the VAO's per-instance attributes
+		GLintptr transform;													// ring buffer offset of the draw's DrawBlock
+		int gpuPass;														// GpuTimer pass to time this draw with, -1 for none
+		int cpuZone;														// Profiler zone named after gpuPass, -1 for none
+	};
+
+	// state changes the queue requested; GLState counts how many reached the driver
+	struct Stats
+	{
+		int draws = 0;
+		long long instances = 0;
+		int programBinds = 0;
+		int vaoBinds = 0;
+		int textureBinds = 0;
+		int dropped = 0;													// draws whose transform did not fit in the ring
+	};
+
+	// called the first time a program is bound in execute(), for uniforms that are
+	// the same for every draw with that program (camera, lights)
+	typedef void (*ProgramSetup)(Shader& shader);
+
+	// registers a texture set; materials persist across frames. Materials whose
+	// maps share arrays differ only in layers and need no texture binds between them
+	// ------------------------------------------------------------------------
+	int addMaterial(const Material& material)
+	{
+		materials.push_back(material);
+		return (int)materials.size() - 1;
+	}
+
+	// ring receives every draw's transform; it must outlive the queue's use
+	// ------------------------------------------------------------------------
+	void setRing(RingBuffer* transforms) { ring = transforms; }
+
+	// depth is the view-space distance, normalized against farPlane for the key
+	// ------------------------------------------------------------------------
+	void submit(Shader& shader, GLuint vao, int material, const glm::mat4& model, GLint first, GLsizei count,
+		GLsizei instances, float depth, int gpuPass = -1)
+	{
+		Draw draw;
+		DrawBlock* block = (DrawBlock*)ring->allocate(sizeof(DrawBlock), draw.transform);
+		if (!block)
+		{
+			++dropped;
+			return;
+		}
+		block->model = model;
+		for (int unit = 0; unit < MAX_TEXTURE_UNITS; ++unit)
+			block->layers[unit] = material >= 0 ? materials[material].layers[unit] : 0;
+		draw.key = makeKey(shader.ID, vao, material, depth);
+		draw.shader = &shader;
+		draw.vao = vao;
+		draw.material = material;
+		draw.first = first;
+		draw.count = count;
+		draw.instances = instances;
+		draw.gpuPass = gpuPass;
+		draw.cpuZone = gpuPass >= 0 ? zoneFor(gpuPass) : -1;
+		draws.push_back(draw);
+	}
+
+	void setFarPlane(float distance) { farPlane = distance; }
+
+	// orders this frame's draws by key
+	// ------------------------------------------------------------------------
+	void sort()
+	{
+		size_t n = draws.size();
+		order.resize(n);
+		scratch.resize(n);
+		keys.resize(n);
+		scratchKeys.resize(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			order[i] = (uint32_t)i;
+			keys[i] = draws[i].key;
+		}
+
+		// 8 passes of 8 bits; a pass where every key has the same digit is skipped
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			size_t counts[256] = {};
+			for (size_t i = 0; i < n; ++i)
+				++counts[(keys[i] >> shift) & 0xFF];
+			if (n == 0 || counts[(keys[0] >> shift) & 0xFF] == n)
+				continue;
+
+			size_t offset = 0;
+			for (int d = 0; d < 256; ++d)
+			{
+				size_t c = counts[d];
+				counts[d] = offset;
+				offset += c;
+			}
+			for (size_t i = 0; i < n; ++i)
+			{
+				size_t dst = counts[(keys[i] >> shift) & 0xFF]++;
+				scratch[dst] = order[i];
+				scratchKeys[dst] = keys[i];
+			}
+			order.swap(scratch);
+			keys.swap(scratchKeys);
+		}
+	}
+
+	// issues the sorted draws with minimal state changes, then empties the queue
+	// ------------------------------------------------------------------------
+	void execute(ProgramSetup setupProgram)
+	{
+		stats = Stats();
+		stats.dropped = dropped;
+		dropped = 0;
+		Shader* currentShader = nullptr;
+		GLuint currentVAO = 0;
+		int currentMaterial = -1;
+		programsSetUp.clear();
+
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			const Draw& draw = draws[order[i]];
+
+			if (draw.shader != currentShader)
+			{
+				draw.shader->use();
+				currentShader = draw.shader;
+				++stats.programBinds;
+				if (std::find(programsSetUp.begin(), programsSetUp.end(), draw.shader->ID) == programsSetUp.end())
+				{
+					programsSetUp.push_back(draw.shader->ID);
+					if (setupProgram)
+						setupProgram(*draw.shader);
+				}
+			}
+
+			if (draw.vao != currentVAO)
+			{
+				GLState::instance().bindVertexArray(draw.vao);
+				currentVAO = draw.vao;
+				++stats.vaoBinds;
+			}
+
+			if (draw.material != currentMaterial && draw.material >= 0)
+			{
+				PROFILE_ZONE("TextureBind");
+				const Material& material = materials[draw.material];
+				for (int unit = 0; unit < MAX_TEXTURE_UNITS; ++unit)
+				{
+					if (material.textures[unit] == 0)
+						continue;
+					GLState::instance().bindTexture(GL_TEXTURE0 + unit, material.target, material.textures[unit]);
+					++stats.textureBinds;
+				}
+				currentMaterial = draw.material;
+			}
+
+			auto drawStart = std::chrono::steady_clock::now();
+			glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_BLOCK_BINDING, ring->getBuffer(), draw.transform, sizeof(DrawBlock));
+			if (draw.gpuPass >= 0)
+				GpuTimer::instance().begin(draw.gpuPass);
+			if (draw.instances > 1)
+				glDrawArraysInstanced(GL_TRIANGLES, draw.first, draw.count, draw.instances);
+			else
+				glDrawArrays(GL_TRIANGLES, draw.first, draw.count);
+			if (draw.gpuPass >= 0)
+				GpuTimer::instance().end(draw.gpuPass);
+			if (draw.cpuZone >= 0)
+				Profiler::instance().record(draw.cpuZone, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - drawStart).count());
+			++stats.draws;
+			stats.instances += draw.instances;
+		}
+
+		draws.clear();
+		order.clear();
+	}
+
+	const Stats& getStats() const { return stats; }
+
+private:
+	// CPU zone for a GPU pass, registered the first time the pass is submitted
+	int zoneFor(int gpuPass)
+	{
+		if (gpuPass >= (int)passZones.size())
+			passZones.resize(gpuPass + 1, -1);
+		if (passZones[gpuPass] < 0)
+			passZones[gpuPass] = Profiler::instance().zone(GpuTimer::instance().passName(gpuPass).c_str());
+		return passZones[gpuPass];
+	}
+
+	uint64_t makeKey(GLuint program, GLuint vao, int material, float depth) const
+	{
+		float normalized = depth / farPlane;
+		if (normalized < 0.0f) normalized = 0.0f;
+		if (normalized > 1.0f) normalized = 1.0f;
+		uint64_t depthBits = (uint64_t)(normalized * 65535.0f);
+		return ((uint64_t)(program & 0xFFFF) << 48) | ((uint64_t)(vao & 0xFFFF) << 32)
+			| ((uint64_t)((material + 1) & 0xFFFF) << 16) | depthBits;
+	}
+
+	float farPlane = 100.0f;
+	RingBuffer* ring = nullptr;
+	int dropped = 0;
+	std::vector<Material> materials;
+	std::vector<Draw> draws;
+	std::vector<uint32_t> order, scratch;
+	std::vector<uint64_t> keys, scratchKeys;
+	std::vector<int> passZones;												// Profiler zone per GpuTimer pass, -1 until used
+	std::vector<GLuint> programsSetUp;										// programs setupProgram already ran for this frame
+	Stats stats;
+};
+#endif
@@ -0,0 +1,227 @@
+#ifndef RESOURCE_CACHE_H
+#define RESOURCE_CACHE_H
+
+#include <glad/glad.h>
+
+#include "shader.h"
+#include "gl_state.h"
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+// Cache of shader programs keyed by source paths and content hash. Programs are
+// compiled once and handed out as reference-counted handles; an entry whose last
+// handle is released stays resident until evictUnused() is called, so a program
+// re-acquired in the meantime is a hit. Textures live in TextureArrays, which
+// places each image file once.
+class ResourceCache
+{
+public:
+	struct Stats
+	{
+		unsigned long long hits = 0;
+		unsigned long long misses = 0;
+		unsigned long long evictions = 0;
+	};
+
+private:
+	struct Entry
+	{
+		std::string key;
+		unsigned long long contentHash = 0;
+		int refCount = 0;
+		std::unique_ptr<Shader> shader;
+	};
+
+public:
+	// reference-counted handle to a cached resource
+	// ------------------------------------------------------------------------
+	class Handle
+	{
+	public:
+		Handle() : entry(nullptr) {}
+		Handle(const Handle& other) : entry(other.entry) { retain(); }
+		Handle(Handle&& other) noexcept : entry(other.entry) { other.entry = nullptr; }
+		~Handle() { release(); }
+
+		Handle& operator=(Handle other)
+		{
+			std::swap(entry, other.entry);
+			return *this;
+		}
+
+		void reset() { release(); entry = nullptr; }
+		bool valid() const { return entry != nullptr; }
+		int useCount() const { return entry ? entry->refCount : 0; }
+
+	protected:
+		friend class ResourceCache;
+		explicit Handle(Entry* e) : entry(e) { retain(); }
+
+		void retain() { if (entry) ++entry->refCount; }
+		void release() { if (entry) --entry->refCount; }
+
+		Entry* entry;
+	};
+
+	class ShaderHandle : public Handle
+	{
+	public:
+		ShaderHandle() {}
+		Shader* operator->() const { return entry->shader.get(); }
+		Shader& operator*() const { return *entry->shader; }
+
+	private:
+		friend class ResourceCache;
+		explicit ShaderHandle(Entry* e) : Handle(e) {}
+	};
+
+	ResourceCache() {}
+
+	~ResourceCache()
+	{
+		clear();
+	}
+
+	ResourceCache(const ResourceCache&) = delete;
+	ResourceCache& operator=(const ResourceCache&) = delete;
+
+	// returns the program for this vertex/fragment pair, compiling it only on a miss
+	// ------------------------------------------------------------------------
+	ShaderHandle acquireShader(const char* vertexPath, const char* fragmentPath)
+	{
+		std::string key = std::string("program:") + vertexPath + "|" + fragmentPath;
+		unsigned long long hash = hashFile(vertexPath, hashFile(fragmentPath));
+
+		Entry* entry = find(key, hash);
+		if (!entry)
+		{
+			entry = insert(key, hash);
+			entry->shader.reset(new Shader(vertexPath, fragmentPath));
+		}
+		return ShaderHandle(entry);
+	}
+
+	// deletes the GL objects of every entry no handle refers to anymore
+	// ------------------------------------------------------------------------
+	int evictUnused()
+	{
+		int evicted = 0;
+		for (auto it = entries.begin(); it != entries.end();)
+		{
+			if (it->second->refCount <= 0)
+			{
+				destroy(*it->second);
+				it = entries.erase(it);
+				++evicted;
+			}
+			else
+				++it;
+		}
+		for (auto it = retired.begin(); it != retired.end();)
+		{
+			if ((*it)->refCount <= 0)
+			{
+				destroy(**it);
+				it = retired.erase(it);
+				++evicted;
+			}
+			else
+				++it;
+		}
+		stats.evictions += evicted;
+		return evicted;
+	}
+
+	// deletes every entry; outstanding handles must not be used afterwards
+	// ------------------------------------------------------------------------
+	void clear()
+	{
+		for (auto& it : entries)
+			destroy(*it.second);
+		for (auto& it : retired)
+			destroy(*it);
+		entries.clear();
+		retired.clear();
+	}
+
+	const Stats& getStats() const { return stats; }
+	size_t size() const { return entries.size(); }
+
+	void printStats(std::ostream& out) const
+	{
+		out << "ResourceCache: " << entries.size() << " resident, "
+			<< stats.hits << " hits, " << stats.misses << " misses, "
+			<< stats.evictions << " evictions" << std::endl;
+	}
+
+private:
+	// looks up a live entry; an entry whose file content changed is retired so the
+	// caller rebuilds it, and is deleted by evictUnused() once its handles are gone
+	// ------------------------------------------------------------------------
+	Entry* find(const std::string& key, unsigned long long hash)
+	{
+		auto it = entries.find(key);
+		if (it == entries.end())
+			return nullptr;
+
+		if (it->second->contentHash == hash)
+		{
+			++stats.hits;
+			return it->second.get();
+		}
+
+		retired.push_back(std::move(it->second));
+		entries.erase(it);
+		return nullptr;
+	}
+
+	Entry* insert(const std::string& key, unsigned long long hash)
+	{
+		++stats.misses;
+		std::unique_ptr<Entry>& slot = entries[key];
+		slot.reset(new Entry());
+		slot->key = key;
+		slot->contentHash = hash;
+		return slot.get();
+	}
+
+	void destroy(Entry& entry)
+	{
+		if (entry.shader)
+		{
+			glDeleteProgram(entry.shader->ID);
+			entry.shader.reset();
+		}
+		GLState::instance().invalidate();										// deleted names may be reused
+	}
+
+	// 64-bit FNV-1a over the file bytes, chained through seed
+	// ------------------------------------------------------------------------
+	static unsigned long long hashFile(const char* path, unsigned long long seed = 14695981039346656037ULL)
+	{
+		unsigned long long hash = seed;
+		std::ifstream file(path, std::ios::binary);
+		char buffer[4096];
+		while (file)
+		{
+			file.read(buffer, sizeof(buffer));
+			std::streamsize count = file.gcount();
+			for (std::streamsize i = 0; i < count; ++i)
+			{
+				hash ^= (unsigned char)buffer[i];
+				hash *= 1099511628211ULL;
+			}
+		}
+		return hash;
+	}
+
+	std::unordered_map<std::string, std::unique_ptr<Entry>> entries;
+	std::vector<std::unique_ptr<Entry>> retired;
+	Stats stats;
+};
+#endif
@@ -0,0 +1,155 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <glad/glad.h>
+
+#include "profiler.h"
+
+#include <chrono>
+#include <cstdint>
+
+// glad is generated for GL 4.3; buffer storage is core in the 4.4 context we
+// create, so the entry point and its flags are fetched here by hand
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// Persistently mapped buffer for data that changes every frame. The buffer is
+// split into one region per frame in flight; the CPU writes the current region
+// through the mapping while the GPU may still be reading the others. Before a
+// region is reused, beginFrame() waits on the fence endFrame() placed after the
+// frame that last used it, so writes never race the GPU. The mapping is coherent:
+// nothing is copied with glBufferSubData and the buffer is never orphaned.
+class RingBuffer
+{
+public:
+	static const int MAX_FRAMES_IN_FLIGHT = 8;
+
+	struct Stats
+	{
+		unsigned long long blockedWaits = 0;									// beginFrame() calls that found the fence unsignaled
+		double waitMilliseconds = 0.0;										// total time spent in those waits
+		unsigned long long overflows = 0;									// allocations that did not fit in their frame's region
+		GLsizeiptr peakBytes = 0;											// most bytes any frame used
+	};
+
+	// needs a current GL context; loader is the one glad was initialized with
+	// ------------------------------------------------------------------------
+	bool create(GLADloadproc loader, GLsizeiptr bytesPerFrame, int framesInFlight)
+	{
+		typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+		BufferStorageProc bufferStorage = (BufferStorageProc)loader("glBufferStorage");
+		if (!bufferStorage || framesInFlight < 1 || framesInFlight > MAX_FRAMES_IN_FLIGHT)
+			return false;
+
+		GLint uniformAlignment = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+		alignment = uniformAlignment > 0 ? uniformAlignment : 256;
+		regionSize = align(bytesPerFrame);
+		frames = framesInFlight;
+
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		bufferStorage(GL_UNIFORM_BUFFER, regionSize * frames, nullptr, flags);
+		mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, regionSize * frames, flags);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		if (!mapped)
+		{
+			glDeleteBuffers(1, &buffer);
+			buffer = 0;
+			return false;
+		}
+
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+			fences[i] = 0;
+		frame = 0;
+		head = 0;
+		return true;
+	}
+
+	void destroy()
+	{
+		if (!buffer)
+			return;
+		for (int i = 0; i < frames; ++i)
+			if (fences[i])
+				glDeleteSync(fences[i]);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+		mapped = nullptr;
+	}
+
+	// moves to the next region, waiting until the GPU has finished reading it
+	// ------------------------------------------------------------------------
+	void beginFrame()
+	{
+		frame = (frame + 1) % frames;
+		head = 0;
+		GLsync fence = fences[frame];
+		if (!fence)
+			return;
+
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			PROFILE_ZONE("Fence Wait");
+			auto start = std::chrono::steady_clock::now();
+			while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+				;
+			stats.blockedWaits++;
+			stats.waitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		glDeleteSync(fence);
+		fences[frame] = 0;
+	}
+
+	// fences the region written this frame; call after its last draw is issued
+	// ------------------------------------------------------------------------
+	void endFrame()
+	{
+		if (head > stats.peakBytes)
+			stats.peakBytes = head;
+		fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	// returns size writable bytes in this frame's region and their offset in the
+	// buffer, aligned for glBindBufferRange(GL_UNIFORM_BUFFER); nullptr when full
+	// ------------------------------------------------------------------------
+	void* allocate(GLsizeiptr size, GLintptr& offset)
+	{
+		GLsizeiptr start = head;
+		if (start + size > regionSize)
+		{
+			stats.overflows++;
+			return nullptr;
+		}
+		head = align(start + size);
+		offset = regionSize * frame + start;
+		return mapped + offset;
+	}
+
+	GLuint getBuffer() const { return buffer; }
+	int getFramesInFlight() const { return frames; }
+	GLsizeiptr getRegionSize() const { return regionSize; }
+	const Stats& getStats() const { return stats; }
+
+private:
+	GLsizeiptr align(GLsizeiptr size) const { return (size + alignment - 1) / alignment * alignment; }
+
+	GLuint buffer = 0;
+	unsigned char* mapped = nullptr;
+	GLsizeiptr alignment = 256;
+	GLsizeiptr regionSize = 0;
+	GLsizeiptr head = 0;													// bytes used in the current region
+	int frames = 0;
+	int frame = 0;
+	GLsync fences[MAX_FRAMES_IN_FLIGHT] = {};
+	Stats stats;
+};
+#endif
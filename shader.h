@@ -5,7 +5,12 @@
 
 #include <glm/glm.hpp>
 
+#include "gl_state.h"
+
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -14,6 +19,38 @@ class Shader
 {
 public:
 	unsigned int ID;
+
+	// handle to an entry of this program's uniform table; fetch it once with
+	// uniform<T>() after loading and pass it to set() on the hot path
+	template <typename T>
+	struct Uniform
+	{
+		int index = -1;
+		int element = 0;												// array element, added to the entry's location
+		bool valid() const { return index >= 0; }
+	};
+
+	// default-block uniform found by reflection; arrays of basic types are one
+	// entry named "name[0]", arrays of structs one entry per member. shadow holds
+	// the last value uploaded through this table (element 0 for arrays; other
+	// elements are always uploaded)
+	struct UniformInfo
+	{
+		std::string name;
+		GLint location;
+		GLenum type;
+		GLint arraySize;
+		bool cached;
+		unsigned char shadow[sizeof(float) * 16];
+	};
+
+	struct BlockInfo
+	{
+		std::string name;
+		GLint binding;
+		GLint dataSize;
+	};
+
 	// constructor generates the shader on the fly
 	// ------------------------------------------------------------------------
 	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
@@ -95,74 +132,259 @@ public:
 		glDeleteShader(fragment);
 		if (geometryPath != nullptr)
 			glDeleteShader(geometry);
-
+		reflect();
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use()
 	{
-		glUseProgram(ID);
+		GLState::instance().useProgram(ID);
 	}
-	// utility uniform functions
+	// utility uniform functions; these search the uniform table, prefer handles
 	// ------------------------------------------------------------------------
 	void setBool(const std::string &name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		set(find<int>(name), (int)value);
 	}
 	// ------------------------------------------------------------------------
 	void setInt(const std::string &name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		set(find<int>(name), value);
 	}
 	// ------------------------------------------------------------------------
 	void setFloat(const std::string &name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		set(find<float>(name), value);
 	}
 	// ------------------------------------------------------------------------
 	void setVec2(const std::string &name, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		set(find<glm::vec2>(name), value);
 	}
 	void setVec2(const std::string &name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		set(find<glm::vec2>(name), glm::vec2(x, y));
 	}
 	// ------------------------------------------------------------------------
 	void setVec3(const std::string &name, const glm::vec3 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		set(find<glm::vec3>(name), value);
 	}
 	void setVec3(const std::string &name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		set(find<glm::vec3>(name), glm::vec3(x, y, z));
 	}
 	// ------------------------------------------------------------------------
 	void setVec4(const std::string &name, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		set(find<glm::vec4>(name), value);
 	}
 	void setVec4(const std::string &name, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		set(find<glm::vec4>(name), glm::vec4(x, y, z, w));
 	}
 	// ------------------------------------------------------------------------
 	void setMat2(const std::string &name, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		set(find<glm::mat2>(name), mat);
 	}
 	// ------------------------------------------------------------------------
 	void setMat3(const std::string &name, const glm::mat3 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		set(find<glm::mat3>(name), mat);
 	}
 	// ------------------------------------------------------------------------
 	void setMat4(const std::string &name, const glm::mat4 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		set(find<glm::mat4>(name), mat);
+	}
+	// resolves a uniform once; returns an invalid handle (set() ignores it) when
+	// the program has no such uniform or its GLSL type does not match T
+	// ------------------------------------------------------------------------
+	template <typename T>
+	Uniform<T> uniform(const std::string &name) const
+	{
+		Uniform<T> handle = find<T>(name);
+		if (handle.index >= 0 && !accepts(uniforms[handle.index].type, (const T*)nullptr))
+		{
+			std::cout << "ERROR::SHADER_UNIFORM_TYPE_MISMATCH: " << name << std::endl;
+			return Uniform<T>();
+		}
+		return handle;
+	}
+	// handle setters: one table index, no string lookup; values equal to the
+	// last upload are skipped and counted by GLState
+	// ------------------------------------------------------------------------
+	void set(Uniform<int> u, int value) const
+	{
+		if (u.index >= 0 && changed(u, &value, sizeof(value)))
+			glUniform1i(location(u), value);
+	}
+	void set(Uniform<float> u, float value) const
+	{
+		if (u.index >= 0 && changed(u, &value, sizeof(value)))
+			glUniform1f(location(u), value);
+	}
+	void set(Uniform<glm::vec2> u, const glm::vec2 &value) const
+	{
+		if (u.index >= 0 && changed(u, &value, sizeof(value)))
+			glUniform2fv(location(u), 1, &value[0]);
+	}
+	void set(Uniform<glm::vec3> u, const glm::vec3 &value) const
+	{
+		if (u.index >= 0 && changed(u, &value, sizeof(value)))
+			glUniform3fv(location(u), 1, &value[0]);
+	}
+	void set(Uniform<glm::vec4> u, const glm::vec4 &value) const
+	{
+		if (u.index >= 0 && changed(u, &value, sizeof(value)))
+			glUniform4fv(location(u), 1, &value[0]);
+	}
+	void set(Uniform<glm::mat2> u, const glm::mat2 &mat) const
+	{
+		if (u.index >= 0 && changed(u, &mat, sizeof(mat)))
+			glUniformMatrix2fv(location(u), 1, GL_FALSE, &mat[0][0]);
+	}
+	void set(Uniform<glm::mat3> u, const glm::mat3 &mat) const
+	{
+		if (u.index >= 0 && changed(u, &mat, sizeof(mat)))
+			glUniformMatrix3fv(location(u), 1, GL_FALSE, &mat[0][0]);
+	}
+	void set(Uniform<glm::mat4> u, const glm::mat4 &mat) const
+	{
+		if (u.index >= 0 && changed(u, &mat, sizeof(mat)))
+			glUniformMatrix4fv(location(u), 1, GL_FALSE, &mat[0][0]);
+	}
+	// reflection results, sorted by name
+	// ------------------------------------------------------------------------
+	const std::vector<UniformInfo>& getUniforms() const { return uniforms; }
+	const std::vector<BlockInfo>& getBlocks() const { return blocks; }
+	// size the linker gave a uniform block, -1 if the program has no such block
+	// ------------------------------------------------------------------------
+	GLint blockSize(const std::string &name) const
+	{
+		for (size_t i = 0; i < blocks.size(); ++i)
+			if (blocks[i].name == name)
+				return blocks[i].dataSize;
+		return -1;
 	}
 
 private:
+	mutable std::vector<UniformInfo> uniforms;							// shadows change on const set()
+	std::vector<BlockInfo> blocks;
+
+	// builds the uniform and block tables from the linked program
+	// ------------------------------------------------------------------------
+	void reflect()
+	{
+		GLint count = 0;
+		std::vector<GLchar> name;
+		glGetProgramInterfaceiv(ID, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+		for (GLint i = 0; i < count; ++i)
+		{
+			const GLenum props[] = { GL_NAME_LENGTH, GL_LOCATION, GL_TYPE, GL_ARRAY_SIZE, GL_BLOCK_INDEX };
+			GLint values[5];
+			glGetProgramResourceiv(ID, GL_UNIFORM, i, 5, props, 5, NULL, values);
+			if (values[4] != -1)
+				continue;											// lives in a uniform block, set through its buffer
+			name.resize(values[0]);
+			glGetProgramResourceName(ID, GL_UNIFORM, i, values[0], NULL, name.data());
+			UniformInfo info = { std::string(name.data()), values[1], (GLenum)values[2], values[3], false, {} };
+			uniforms.push_back(info);
+		}
+		std::sort(uniforms.begin(), uniforms.end(),
+			[](const UniformInfo& a, const UniformInfo& b) { return a.name < b.name; });
+
+		glGetProgramInterfaceiv(ID, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &count);
+		for (GLint i = 0; i < count; ++i)
+		{
+			const GLenum props[] = { GL_NAME_LENGTH, GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+			GLint values[3];
+			glGetProgramResourceiv(ID, GL_UNIFORM_BLOCK, i, 3, props, 3, NULL, values);
+			name.resize(values[0]);
+			glGetProgramResourceName(ID, GL_UNIFORM_BLOCK, i, values[0], NULL, name.data());
+			BlockInfo info = { std::string(name.data()), values[1], values[2] };
+			blocks.push_back(info);
+		}
+	}
+	// handle for name without checking its type
+	// ------------------------------------------------------------------------
+	template <typename T>
+	Uniform<T> find(const std::string &name) const
+	{
+		Uniform<T> handle;
+		handle.index = findUniform(name, handle.element);
+		return handle;
+	}
+	// table index of name, also matching "name[0]" for arrays; -1 if inactive.
+	// "name[N]" resolves to the "name[0]" entry with element N, if N is inside
+	// the array the linker kept, as glGetUniformLocation would
+	// ------------------------------------------------------------------------
+	int findUniform(const std::string &name, int &element) const
+	{
+		element = 0;
+		int index = lookup(name);
+		if (index >= 0)
+			return index;
+
+		size_t open = name.find_last_of('[');
+		if (open == std::string::npos || open + 2 >= name.size() || name.back() != ']')
+			return lookup(name + "[0]");
+		int n = 0;
+		for (size_t i = open + 1; i + 1 < name.size(); ++i)
+		{
+			if (name[i] < '0' || name[i] > '9' || n > 100000)
+				return -1;
+			n = n * 10 + (name[i] - '0');
+		}
+		index = lookup(name.substr(0, open) + "[0]");
+		if (index < 0 && n == 0)
+			index = lookup(name.substr(0, open));						// GL accepts "name[0]" for a non-array too
+		if (index < 0 || n >= uniforms[index].arraySize)
+			return -1;
+		element = n;
+		return index;
+	}
+	int lookup(const std::string &key) const
+	{
+		auto it = std::lower_bound(uniforms.begin(), uniforms.end(), key,
+			[](const UniformInfo& info, const std::string& k) { return info.name < k; });
+		return it != uniforms.end() && it->name == key ? (int)(it - uniforms.begin()) : -1;
+	}
+	template <typename T>
+	GLint location(Uniform<T> u) const { return uniforms[u.index].location + u.element; }
+	// compares value with the entry's shadow copy and updates it; false when the
+	// upload can be skipped. Only element 0 of an array is shadowed
+	// ------------------------------------------------------------------------
+	template <typename T>
+	bool changed(Uniform<T> u, const void* value, size_t size) const
+	{
+		UniformInfo& info = uniforms[u.index];
+		bool redundant = u.element == 0 && info.cached && memcmp(info.shadow, value, size) == 0;
+		if (GLState::instance().uniform(redundant))
+			return false;
+		if (u.element == 0)
+		{
+			memcpy(info.shadow, value, size);
+			info.cached = true;
+		}
+		return true;
+	}
+	// GLSL types each handle type may be bound to
+	// ------------------------------------------------------------------------
+	static bool accepts(GLenum type, const int*)
+	{
+		return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D || type == GL_SAMPLER_2D_ARRAY
+			|| type == GL_SAMPLER_3D || type == GL_SAMPLER_CUBE;
+	}
+	static bool accepts(GLenum type, const float*) { return type == GL_FLOAT; }
+	static bool accepts(GLenum type, const glm::vec2*) { return type == GL_FLOAT_VEC2; }
+	static bool accepts(GLenum type, const glm::vec3*) { return type == GL_FLOAT_VEC3; }
+	static bool accepts(GLenum type, const glm::vec4*) { return type == GL_FLOAT_VEC4; }
+	static bool accepts(GLenum type, const glm::mat2*) { return type == GL_FLOAT_MAT2; }
+	static bool accepts(GLenum type, const glm::mat3*) { return type == GL_FLOAT_MAT3; }
+	static bool accepts(GLenum type, const glm::mat4*) { return type == GL_FLOAT_MAT4; }
+
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)
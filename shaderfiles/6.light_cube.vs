@@ -1,9 +1,18 @@
-#version 330 core
+#version 420 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140, binding = 0) uniform Draw     // per-draw data streamed through the ring buffer
+{
+    mat4 model;
+    ivec4 layers;                              // texture array layer per material unit
+};
+layout (std140, binding = 1) uniform Camera   // written once per frame
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    vec3 spotDirection;                        // the flashlight follows the camera
+};
 
 void main()
 {
@@ -1,9 +1,9 @@
-#version 330 core
+#version 420 core
 out vec4 FragColor;
 
 struct Material {
-    sampler2D diffuse;
-    sampler2D specular;
+    sampler2DArray diffuse;   // unit 0, layer layers.x
+    sampler2DArray specular;  // unit 1, layer layers.y
     float shininess;
 }; 
 
@@ -30,7 +30,6 @@ struct PointLight {
 
 struct SpotLight {
     vec3 position;
-    vec3 direction;
     float cutOff;
     float outerCutOff;
   
@@ -48,11 +47,27 @@ struct SpotLight {
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+in vec3 Tint;
+
+layout (std140, binding = 0) uniform Draw     // per-draw data streamed through the ring buffer
+{
+    mat4 model;
+    ivec4 layers;                              // texture array layer per material unit
+};
+layout (std140, binding = 1) uniform Camera   // written once per frame
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    vec3 spotDirection;                        // the flashlight follows the camera
+};
+layout (std140, binding = 2) uniform Lights   // fixed; written once at startup
+{
+    DirLight dirLight;
+    PointLight pointLights[NR_POINT_LIGHTS];
+    SpotLight spotLight;
+};
 
-uniform vec3 viewPos;
-uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
-uniform SpotLight spotLight;
 uniform Material material;
 
 // function prototypes
@@ -79,7 +94,7 @@ void main()
         result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);    
     // phase 3: spot light
     result += CalcSpotLight(spotLight, norm, FragPos, viewDir);    
-    FragColor = vec4(result, 1.0);
+    FragColor = vec4(result * Tint, 1.0);
 }
 
 // calculates the color when using a directional light.
@@ -92,9 +107,9 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * vec3(texture(material.diffuse, vec3(TexCoords, layers.x)));
+    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, vec3(TexCoords, layers.x)));
+    vec3 specular = light.specular * spec * vec3(texture(material.specular, vec3(TexCoords, layers.y)));
     return (ambient + diffuse + specular);
 }
 
@@ -111,9 +126,9 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * vec3(texture(material.diffuse, vec3(TexCoords, layers.x)));
+    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, vec3(TexCoords, layers.x)));
+    vec3 specular = light.specular * spec * vec3(texture(material.specular, vec3(TexCoords, layers.y)));
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
@@ -133,13 +148,13 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
     // spotlight intensity
-    float theta = dot(lightDir, normalize(-light.direction)); 
+    float theta = dot(lightDir, normalize(-spotDirection)); 
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * vec3(texture(material.diffuse, vec3(TexCoords, layers.x)));
+    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, vec3(TexCoords, layers.x)));
+    vec3 specular = light.specular * spec * vec3(texture(material.specular, vec3(TexCoords, layers.y)));
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
@@ -1,21 +1,35 @@
-#version 330 core
+#version 420 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in mat4 aInstanceModel; // per instance, locations 3-6
+layout (location = 7) in vec3 aInstanceTint;  // per instance
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+out vec3 Tint;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140, binding = 0) uniform Draw     // per-draw data streamed through the ring buffer
+{
+    mat4 model;
+    ivec4 layers;                              // texture array layer per material unit
+};
+layout (std140, binding = 1) uniform Camera   // written once per frame
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    vec3 spotDirection;                        // the flashlight follows the camera
+};
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;  
+    mat4 world = model * aInstanceModel;
+    FragPos = vec3(world * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(world))) * aNormal;  
     TexCoords = aTexCoords;
+    Tint = aInstanceTint;
     
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
\ No newline at end of file
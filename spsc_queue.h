@@ -0,0 +1,59 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Capacity must be a power of two. push() never blocks: when the queue is full the
+// item is rejected and counted, so the producer can never be held up by a slow
+// consumer.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+	SpscQueue() : head(0), tail(0), rejected(0) {}
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	// producer side
+	// ------------------------------------------------------------------------
+	bool push(const T& item)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == Capacity)
+		{
+			rejected.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		items[t & (Capacity - 1)] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side
+	// ------------------------------------------------------------------------
+	bool pop(T& item)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		item = items[h & (Capacity - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	unsigned long long getRejected() const { return rejected.load(std::memory_order_relaxed); }
+
+private:
+	// head and tail live on separate cache lines so producer and consumer do not
+	// invalidate each other's line on every operation
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+	alignas(64) std::atomic<unsigned long long> rejected;
+	T items[Capacity];
+};
+#endif
@@ -263,7 +263,10 @@ RECENT REVISION HISTORY:
 // code.)
 //
 // On x86, SSE2 will automatically be used when available based on a run-time
-// test; if not, the generic C versions are used as a fall-back. On ARM targets,
+// test; if not, the generic C versions are used as a fall-back. The same test
+// picks SSSE3 and AVX2 kernels for PNG unfiltering and AVX2 kernels for the
+// JPEG IDCT, 2x2 chroma upsampling and YCbCr conversion, all producing the same
+// bytes as the generic code; stbi_set_simd_limit() caps the level used. On ARM targets,
 // the typical path is to have separate builds for NEON and non-NEON devices
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
@@ -272,6 +275,19 @@ RECENT REVISION HISTORY:
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
 //
+// The zlib decoder used for PNG inflates with a 64-bit bit buffer and
+// lookup tables that resolve up to two literals, or a length or distance
+// together with its extra bits, per lookup. Define STBI_NO_FAST_INFLATE to get
+// the original bit-at-a-time Huffman decoder instead.
+//
+// stb_image starts no threads, but a baseline JPEG with restart markers can be
+// decoded by the caller's thread pool: hand it to stbi_set_parallel_for() and
+// the entropy-coded data of such a scan is split at its RSTn markers, the
+// restart intervals being independent. Only images loaded from memory are
+// split; files and callbacks stream and are always decoded serially, as are
+// progressive JPEGs and JPEGs without a restart interval. Upsampling and color
+// conversion of every large JPEG are split by output rows.
+//
 // ===========================================================================
 //
 // HDR image support   (disable by defining STBI_NO_HDR)
@@ -427,6 +443,15 @@ extern "C" {
     // for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
 
+    // load at 1/scale of the full size, scale being 1, 2, 4 or 8 and each side
+    // rounded up. JPEGs decode straight to that size through a shortened IDCT,
+    // which is several times faster than a full decode; other formats are
+    // decoded in full and box-filtered down.
+    STBIDEF stbi_uc* stbi_load_from_memory_scaled(stbi_uc const* buffer, int len, int* x, int* y, int* channels_in_file, int desired_channels, int scale);
+#ifndef STBI_NO_STDIO
+    STBIDEF stbi_uc* stbi_load_scaled(char const* filename, int* x, int* y, int* channels_in_file, int desired_channels, int scale);
+#endif
+
 #ifndef STBI_NO_GIF
     STBIDEF stbi_uc* stbi_load_gif_from_memory(stbi_uc const* buffer, int len, int** delays, int* x, int* y, int* z, int* comp, int req_comp);
 #endif
@@ -515,6 +540,20 @@ extern "C" {
     // flip the image vertically, so the first pixel in the output array is the bottom left
     STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+    // cap the SIMD code paths picked at run time, e.g. to compare them; the
+    // default, STBI_SIMD_AVX2, allows everything the CPU supports
+    enum { STBI_SIMD_NONE = 0, STBI_SIMD_SSE2, STBI_SIMD_SSSE3, STBI_SIMD_AVX2 };
+    STBIDEF void stbi_set_simd_limit(int level);
+    STBIDEF int  stbi_simd_level(void); // what is actually used: CPU support capped by the limit
+
+    // lets JPEG restart intervals and output rows decode in parallel: run(user, count, task, task_data)
+    // must call task(task_data, begin, end) over ranges that together cover
+    // [0, count) exactly once, possibly concurrently, and return when all are
+    // done. Pass NULL to decode serially again (the default)
+    typedef void stbi_parallel_task(void* task_data, int begin, int end);
+    typedef void stbi_parallel_for(void* user, int count, stbi_parallel_task* task, void* task_data);
+    STBIDEF void stbi_set_parallel_for(stbi_parallel_for* run, void* user);
+
     // as above, but only applies to images loaded on the thread that calls the function
     // this function is only available if your compiler supports thread-local variables;
     // calling it will fail to link if your compiler doesn't
@@ -770,6 +809,45 @@ static int stbi__sse2_available(void)
 #endif
 
 #endif
+
+// SSSE3 and AVX2 kernels are only called after a cpuid check, so GCC and Clang
+// compile them with a target attribute and the rest of the file keeps the
+// baseline instruction set
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define STBI__TARGET_SSSE3
+#define STBI__TARGET_AVX2
+#else
+#include <cpuid.h>
+#define STBI__TARGET_SSSE3 __attribute__((target("ssse3")))
+#define STBI__TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+
+static int stbi__cpu_simd_level(void)
+{
+    int level = STBI_SIMD_NONE;
+    unsigned long long xcr0 = 0;
+#ifdef _MSC_VER
+    int info1[4], info7[4];
+    __cpuid(info1, 1);
+    __cpuidex(info7, 7, 0);
+    if ((info1[2] >> 27) & 1) xcr0 = _xgetbv(0);
+#else
+    unsigned int info1[4] = { 0 }, info7[4] = { 0 };
+    __cpuid(1, info1[0], info1[1], info1[2], info1[3]);
+    if (__get_cpuid_max(0, 0) >= 7) __cpuid_count(7, 0, info7[0], info7[1], info7[2], info7[3]);
+    if ((info1[2] >> 27) & 1) {
+        unsigned int eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        xcr0 = ((unsigned long long)edx << 32) | eax;
+    }
+#endif
+    if ((info1[3] >> 26) & 1) level = STBI_SIMD_SSE2;
+    if (level == STBI_SIMD_SSE2 && ((info1[2] >> 9) & 1)) level = STBI_SIMD_SSSE3;
+    // AVX2 also needs the OS to save ymm state (OSXSAVE, AVX, XCR0 bits 1-2)
+    if (level == STBI_SIMD_SSSE3 && ((info1[2] >> 28) & 1) && (xcr0 & 6) == 6 && ((info7[1] >> 5) & 1)) level = STBI_SIMD_AVX2;
+    return level;
+}
 #endif
 
 // ARM NEON
@@ -815,6 +893,8 @@ typedef struct
 
     stbi_uc* img_buffer, * img_buffer_end;
     stbi_uc* img_buffer_original, * img_buffer_original_end;
+
+    int scale_shift; // stbi_load_scaled: output at 1 / (1 << scale_shift) of the full size
 } stbi__context;
 
 
@@ -826,6 +906,7 @@ static void stbi__start_mem(stbi__context* s, stbi_uc const* buffer, int len)
     s->io.read = NULL;
     s->read_from_callbacks = 0;
     s->callback_already_read = 0;
+    s->scale_shift = 0;
     s->img_buffer = s->img_buffer_original = (stbi_uc*)buffer;
     s->img_buffer_end = s->img_buffer_original_end = (stbi_uc*)buffer + len;
 }
@@ -838,6 +919,7 @@ static void stbi__start_callbacks(stbi__context* s, stbi_io_callbacks* c, void*
     s->buflen = sizeof(s->buffer_start);
     s->read_from_callbacks = 1;
     s->callback_already_read = 0;
+    s->scale_shift = 0;
     s->img_buffer = s->img_buffer_original = s->buffer_start;
     stbi__refill_buffer(s);
     s->img_buffer_original_end = s->img_buffer_end;
@@ -901,6 +983,7 @@ typedef struct
     int bits_per_channel;
     int num_channels;
     int channel_order;
+    int scale_shift; // how much of s->scale_shift the loader already applied
 } stbi__result_info;
 
 #ifndef STBI_NO_JPEG
@@ -1109,6 +1192,58 @@ static float* stbi__ldr_to_hdr(stbi_uc* data, int x, int y, int comp);
 static stbi_uc* stbi__hdr_to_ldr(float* data, int x, int y, int comp);
 #endif
 
+#ifdef STBI_SSE2
+// decodes on any thread read the detected level and the limit, and the limit
+// can be changed while they run, so both are only touched through these
+#if defined(_MSC_VER) && _MSC_VER >= 1400
+#define stbi__atomic_load(p)     ((int)_InterlockedOr((long volatile*)(p), 0))
+#define stbi__atomic_store(p, v) ((void)_InterlockedExchange((long volatile*)(p), (long)(v)))
+#elif defined(_MSC_VER)
+#define stbi__atomic_load(p)     (*(int volatile*)(p))
+#define stbi__atomic_store(p, v) ((void)(*(int volatile*)(p) = (v)))
+#else
+#define stbi__atomic_load(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+#define stbi__atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+static int stbi__simd_limit = STBI_SIMD_AVX2;
+static int stbi__simd_detected = -1;
+#endif
+
+STBIDEF void stbi_set_simd_limit(int level)
+{
+#ifdef STBI_SSE2
+    stbi__atomic_store(&stbi__simd_limit, level);
+#else
+    STBI_NOTUSED(level);
+#endif
+}
+
+STBIDEF int stbi_simd_level(void)
+{
+#ifdef STBI_SSE2
+    int detected = stbi__atomic_load(&stbi__simd_detected), limit;
+    if (detected < 0) {
+        // threads racing here all store the same value
+        detected = stbi__cpu_simd_level();
+        stbi__atomic_store(&stbi__simd_detected, detected);
+    }
+    limit = stbi__atomic_load(&stbi__simd_limit);
+    return detected < limit ? detected : limit;
+#else
+    return STBI_SIMD_NONE;
+#endif
+}
+
+static stbi_parallel_for* stbi__parallel_run = NULL;
+static void* stbi__parallel_user = NULL;
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for* run, void* user)
+{
+    stbi__parallel_run = run;
+    stbi__parallel_user = user;
+}
+
 static int stbi__vertically_flip_on_load_global = 0;
 
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
@@ -1255,6 +1390,33 @@ static void stbi__vertical_flip_slices(void* image, int w, int h, int z, int byt
 }
 #endif
 
+// for loaders that can't decode at a reduced size: averages each
+// (1 << shift)-square block in place, partial blocks at the edges included
+static void stbi__box_downsample(stbi_uc* data, int* x, int* y, int n, int shift)
+{
+    int w = *x, h = *y, f = 1 << shift;
+    int nw = (w + f - 1) >> shift, nh = (h + f - 1) >> shift;
+    int i, j, c, u, v;
+    // output pixel (i,j) lands at or before the first input byte of its block,
+    // and after every block already read
+    for (j = 0; j < nh; ++j) {
+        int y0 = j << shift, y1 = y0 + f < h ? y0 + f : h;
+        for (i = 0; i < nw; ++i) {
+            int x0 = i << shift, x1 = x0 + f < w ? x0 + f : w;
+            int count = (x1 - x0) * (y1 - y0);
+            for (c = 0; c < n; ++c) {
+                int sum = 0;
+                for (v = y0; v < y1; ++v)
+                    for (u = x0; u < x1; ++u)
+                        sum += data[((size_t)v * w + u) * n + c];
+                data[((size_t)j * nw + i) * n + c] = (stbi_uc)((sum + count / 2) / count);
+            }
+        }
+    }
+    *x = nw;
+    *y = nh;
+}
+
 static unsigned char* stbi__load_and_postprocess_8bit(stbi__context* s, int* x, int* y, int* comp, int req_comp)
 {
     stbi__result_info ri;
@@ -1271,6 +1433,9 @@ static unsigned char* stbi__load_and_postprocess_8bit(stbi__context* s, int* x,
         ri.bits_per_channel = 8;
     }
 
+    if (s->scale_shift > ri.scale_shift)
+        stbi__box_downsample((stbi_uc*)result, x, y, req_comp ? req_comp : *comp, s->scale_shift - ri.scale_shift);
+
     // @TODO: move stbi__convert_format to here
 
     if (stbi__vertically_flip_on_load) {
@@ -1371,6 +1536,21 @@ STBIDEF stbi_uc* stbi_load(char const* filename, int* x, int* y, int* comp, int
     return result;
 }
 
+STBIDEF stbi_uc* stbi_load_scaled(char const* filename, int* x, int* y, int* comp, int req_comp, int scale)
+{
+    FILE* f;
+    unsigned char* result;
+    stbi__context s;
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8) return stbi__errpuc("bad scale", "Scale must be 1, 2, 4 or 8");
+    f = stbi__fopen(filename, "rb");
+    if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+    stbi__start_file(&s, f);
+    s.scale_shift = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+    result = stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
+    fclose(f);
+    return result;
+}
+
 STBIDEF stbi_uc* stbi_load_from_file(FILE* f, int* x, int* y, int* comp, int req_comp)
 {
     unsigned char* result;
@@ -1431,6 +1611,15 @@ STBIDEF stbi_uc* stbi_load_from_memory(stbi_uc const* buffer, int len, int* x, i
     return stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
 }
 
+STBIDEF stbi_uc* stbi_load_from_memory_scaled(stbi_uc const* buffer, int len, int* x, int* y, int* comp, int req_comp, int scale)
+{
+    stbi__context s;
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8) return stbi__errpuc("bad scale", "Scale must be 1, 2, 4 or 8");
+    stbi__start_mem(&s, buffer, len);
+    s.scale_shift = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+    return stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
+}
+
 STBIDEF stbi_uc* stbi_load_from_callbacks(stbi_io_callbacks const* clbk, void* user, int* x, int* y, int* comp, int req_comp)
 {
     stbi__context s;
@@ -1974,6 +2163,9 @@ typedef struct
         stbi_uc* linebuf;
         short* coeff;   // progressive only
         int      coeff_w, coeff_h; // number of 8x8 coefficient blocks
+
+        int dct_shift; // blocks decode to (8 >> dct_shift) pixels square
+        void (*idct_kernel)(stbi_uc* out, int out_stride, short data[64]);
     } img_comp[4];
 
     stbi__uint32   code_buffer; // jpeg entropy-coded buffer
@@ -1993,6 +2185,7 @@ typedef struct
 
     int scan_n, order[4];
     int restart_interval, todo;
+    int scale_shift; // output is 1 / (1 << scale_shift) of the full size
 
     // kernels
     void (*idct_block_kernel)(stbi_uc* out, int out_stride, short data[64]);
@@ -2534,6 +2727,99 @@ static void stbi__idct_block(stbi_uc* out, int out_stride, short data[64])
     }
 }
 
+// reduced-size IDCTs for stbi_load_scaled: each turns a block into a 4x4,
+// 2x2 or 1x1 patch of the image at 1/2, 1/4 or 1/8 scale by evaluating only
+// the low-frequency outputs (after IJG's jidctred.c). Like the 8x8 version
+// they keep 2 extra bits between passes; the stbi__f2f constants add 12 more.
+static void stbi__idct_block_4x4(stbi_uc* out, int out_stride, short data[64])
+{
+    int i, val[32], * v = val;
+    stbi_uc* o;
+    short* d = data;
+
+    // columns; column 4 never reaches the 4-point row pass
+    for (i = 0; i < 8; ++i, ++d, ++v) {
+        int t0, t2, t10, t12;
+        if (i == 4) continue;
+        if (d[8] == 0 && d[16] == 0 && d[24] == 0 && d[40] == 0 && d[48] == 0 && d[56] == 0) {
+            int dcterm = d[0] * 4;
+            v[0] = v[8] = v[16] = v[24] = dcterm;
+            continue;
+        }
+        t0 = d[0] * (1 << 13);
+        t2 = d[16] * stbi__f2f(1.847759065f) + d[48] * stbi__f2f(-0.765366865f);
+        t10 = t0 + t2 + 1024;
+        t12 = t0 - t2 + 1024;
+        t0 = d[56] * stbi__f2f(-0.211164243f) + d[40] * stbi__f2f(1.451774981f)
+            + d[24] * stbi__f2f(-2.172734803f) + d[8] * stbi__f2f(1.061594337f);
+        t2 = d[56] * stbi__f2f(-0.509795579f) + d[40] * stbi__f2f(-0.601344887f)
+            + d[24] * stbi__f2f(0.899976223f) + d[8] * stbi__f2f(2.562915447f);
+        v[0] = (t10 + t2) >> 11;
+        v[24] = (t10 - t2) >> 11;
+        v[8] = (t12 + t0) >> 11;
+        v[16] = (t12 - t0) >> 11;
+    }
+
+    // rows; 12 bits from the constants, 2 from the first pass, 3+1 of DCT
+    // scale, rounded and offset by 128 the same way as the 8x8 version.
+    // Summed unsigned: corrupt coefficients can take the sums past INT_MAX,
+    // and there they should wrap to a clamped garbage pixel, not overflow
+    for (i = 0, v = val, o = out; i < 4; ++i, v += 8, o += out_stride) {
+        unsigned int t0, t2, t10, t12;
+        t0 = (unsigned int)v[0] << 13;
+        t2 = (unsigned int)v[2] * stbi__f2f(1.847759065f) + (unsigned int)v[6] * stbi__f2f(-0.765366865f);
+        t10 = t0 + t2 + (1 << 17) + (128 << 18);
+        t12 = t0 - t2 + (1 << 17) + (128 << 18);
+        t0 = (unsigned int)v[7] * stbi__f2f(-0.211164243f) + (unsigned int)v[5] * stbi__f2f(1.451774981f)
+            + (unsigned int)v[3] * stbi__f2f(-2.172734803f) + (unsigned int)v[1] * stbi__f2f(1.061594337f);
+        t2 = (unsigned int)v[7] * stbi__f2f(-0.509795579f) + (unsigned int)v[5] * stbi__f2f(-0.601344887f)
+            + (unsigned int)v[3] * stbi__f2f(0.899976223f) + (unsigned int)v[1] * stbi__f2f(2.562915447f);
+        o[0] = stbi__clamp((int)(t10 + t2) >> 18);
+        o[3] = stbi__clamp((int)(t10 - t2) >> 18);
+        o[1] = stbi__clamp((int)(t12 + t0) >> 18);
+        o[2] = stbi__clamp((int)(t12 - t0) >> 18);
+    }
+}
+
+static void stbi__idct_block_2x2(stbi_uc* out, int out_stride, short data[64])
+{
+    int i, val[16], * v = val;
+    stbi_uc* o;
+    short* d = data;
+
+    // columns; the 2-point row pass only reads columns 0, 1, 3, 5 and 7
+    for (i = 0; i < 8; ++i, ++d, ++v) {
+        int t0, t10;
+        if (i == 2 || i == 4 || i == 6) continue;
+        if (d[8] == 0 && d[24] == 0 && d[40] == 0 && d[56] == 0) {
+            v[0] = v[8] = d[0] * 4;
+            continue;
+        }
+        t10 = d[0] * (1 << 14) + 2048;
+        t0 = d[56] * stbi__f2f(-0.720959822f) + d[40] * stbi__f2f(0.850430095f)
+            + d[24] * stbi__f2f(-1.272758580f) + d[8] * stbi__f2f(3.624509785f);
+        v[0] = (t10 + t0) >> 12;
+        v[8] = (t10 - t0) >> 12;
+    }
+
+    // rows, unsigned for the same reason as the 4x4 version
+    for (i = 0, v = val, o = out; i < 2; ++i, v += 8, o += out_stride) {
+        unsigned int t0, t10;
+        t10 = ((unsigned int)v[0] << 14) + (1 << 18) + (128 << 19);
+        t0 = (unsigned int)v[7] * stbi__f2f(-0.720959822f) + (unsigned int)v[5] * stbi__f2f(0.850430095f)
+            + (unsigned int)v[3] * stbi__f2f(-1.272758580f) + (unsigned int)v[1] * stbi__f2f(3.624509785f);
+        o[0] = stbi__clamp((int)(t10 + t0) >> 19);
+        o[1] = stbi__clamp((int)(t10 - t0) >> 19);
+    }
+}
+
+static void stbi__idct_block_1x1(stbi_uc* out, int out_stride, short data[64])
+{
+    STBI_NOTUSED(out_stride);
+    // the DC term is 8x the block's mean
+    out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2713,6 +2999,157 @@ static void stbi__idct_simd(stbi_uc* out, int out_stride, short data[64])
 #undef dct_pass
 }
 
+// AVX2 version of the above with the same arithmetic, so also bit-identical to
+// the generic C version: each 32-bit intermediate row sits in one ymm register
+// instead of an _l/_h pair of xmm registers, halving the widened work. The
+// 16-bit rows and the transposes stay 128 bits wide.
+STBI__TARGET_AVX2 static void stbi__idct_avx2(stbi_uc* out, int out_stride, short data[64])
+{
+    __m128i row0, row1, row2, row3, row4, row5, row6, row7;
+    __m128i tmp;
+
+    // dot product constant: even elems=x, odd elems=y
+#define dct_const(x,y)  _mm256_set1_epi32((int)(((unsigned)(x) & 0xffff) | ((unsigned)(y) << 16)))
+
+// out0 = c0[even]*x + c0[odd]*y, out1 likewise with c1   (x, y 16-bit, out 32-bit)
+#define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##xy = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16((x),(y))), _mm_unpackhi_epi16((x),(y)), 1); \
+      __m256i out0 = _mm256_madd_epi16(c0##xy, c0); \
+      __m256i out1 = _mm256_madd_epi16(c0##xy, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+#define dct_widen(out, in) \
+      __m256i out = _mm256_slli_epi32(_mm256_cvtepi16_epi32(in), 12)
+
+   // butterfly a/b, add bias, then shift by "s" and pack
+#define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased = _mm256_add_epi32(a, bias); \
+         __m256i sum = _mm256_srai_epi32(_mm256_add_epi32(abiased, b), s); \
+         __m256i dif = _mm256_srai_epi32(_mm256_sub_epi32(abiased, b), s); \
+         __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(sum, dif), 0xd8); \
+         out0 = _mm256_castsi256_si128(packed); \
+         out1 = _mm256_extracti128_si256(packed, 1); \
+      }
+
+   // 8-bit interleave step (for transposes)
+#define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+   // 16-bit interleave step (for transposes)
+#define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+#define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         __m256i x0 = _mm256_add_epi32(t0e, t3e); \
+         __m256i x3 = _mm256_sub_epi32(t0e, t3e); \
+         __m256i x1 = _mm256_add_epi32(t1e, t2e); \
+         __m256i x2 = _mm256_sub_epi32(t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         __m256i x4 = _mm256_add_epi32(y0o, y4o); \
+         __m256i x5 = _mm256_add_epi32(y1o, y5o); \
+         __m256i x6 = _mm256_add_epi32(y2o, y5o); \
+         __m256i x7 = _mm256_add_epi32(y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+    __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+    __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
+    __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+    __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+    __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f));
+    __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f));
+    __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f));
+    __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f));
+
+    // rounding biases in column/row passes, see stbi__idct_block for explanation.
+    __m256i bias_0 = _mm256_set1_epi32(512);
+    __m256i bias_1 = _mm256_set1_epi32(65536 + (128 << 17));
+
+    // load
+    row0 = _mm_load_si128((const __m128i*) (data + 0 * 8));
+    row1 = _mm_load_si128((const __m128i*) (data + 1 * 8));
+    row2 = _mm_load_si128((const __m128i*) (data + 2 * 8));
+    row3 = _mm_load_si128((const __m128i*) (data + 3 * 8));
+    row4 = _mm_load_si128((const __m128i*) (data + 4 * 8));
+    row5 = _mm_load_si128((const __m128i*) (data + 5 * 8));
+    row6 = _mm_load_si128((const __m128i*) (data + 6 * 8));
+    row7 = _mm_load_si128((const __m128i*) (data + 7 * 8));
+
+    // column pass
+    dct_pass(bias_0, 10);
+
+    {
+        // 16bit 8x8 transpose
+        dct_interleave16(row0, row4);
+        dct_interleave16(row1, row5);
+        dct_interleave16(row2, row6);
+        dct_interleave16(row3, row7);
+        dct_interleave16(row0, row2);
+        dct_interleave16(row1, row3);
+        dct_interleave16(row4, row6);
+        dct_interleave16(row5, row7);
+        dct_interleave16(row0, row1);
+        dct_interleave16(row2, row3);
+        dct_interleave16(row4, row5);
+        dct_interleave16(row6, row7);
+    }
+
+    // row pass
+    dct_pass(bias_1, 17);
+
+    {
+        // pack, then 8bit 8x8 transpose
+        __m128i p0 = _mm_packus_epi16(row0, row1);
+        __m128i p1 = _mm_packus_epi16(row2, row3);
+        __m128i p2 = _mm_packus_epi16(row4, row5);
+        __m128i p3 = _mm_packus_epi16(row6, row7);
+        dct_interleave8(p0, p2);
+        dct_interleave8(p1, p3);
+        dct_interleave8(p0, p1);
+        dct_interleave8(p2, p3);
+        dct_interleave8(p0, p2);
+        dct_interleave8(p1, p3);
+
+        // store
+        _mm_storel_epi64((__m128i*) out, p0); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, p2); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, p1); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, p3); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p3, 0x4e));
+    }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+}
+
 #endif // STBI_SSE2
 
 #ifdef STBI_NEON
@@ -2957,10 +3394,43 @@ static void stbi__jpeg_reset(stbi__jpeg* j)
     // since we don't even allow 1<<30 pixels
 }
 
+// decodes and IDCTs MCU (i,j) of a baseline scan; in a non-interleaved scan
+// every MCU is a single block
+static int stbi__jpeg_decode_baseline_mcu(stbi__jpeg* z, short data[64], int i, int j)
+{
+    int k, x, y;
+    if (z->scan_n == 1) {
+        int n = z->order[0], ha = z->img_comp[n].ha;
+        if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+        z->img_comp[n].idct_kernel(z->img_comp[n].data + ((z->img_comp[n].w2 * j * 8 + i * 8) >> z->img_comp[n].dct_shift), z->img_comp[n].w2, data);
+        return 1;
+    }
+    // scan an interleaved mcu... process scan_n components in order
+    for (k = 0; k < z->scan_n; ++k) {
+        int n = z->order[k];
+        // scan out an mcu's worth of this component; that's just determined
+        // by the basic H and V specified for the component
+        for (y = 0; y < z->img_comp[n].v; ++y) {
+            for (x = 0; x < z->img_comp[n].h; ++x) {
+                int x2 = (i * z->img_comp[n].h + x) * (8 >> z->img_comp[n].dct_shift);
+                int y2 = (j * z->img_comp[n].v + y) * (8 >> z->img_comp[n].dct_shift);
+                int ha = z->img_comp[n].ha;
+                if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                z->img_comp[n].idct_kernel(z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2, z->img_comp[n].w2, data);
+            }
+        }
+    }
+    return 1;
+}
+
+static int stbi__parse_restart_intervals(stbi__jpeg* z);
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
 {
     stbi__jpeg_reset(z);
     if (!z->progressive) {
+        int r = stbi__parse_restart_intervals(z);
+        if (r >= 0) return r; // -1: not split, decode it here
         if (z->scan_n == 1) {
             int i, j;
             STBI_SIMD_ALIGN(short, data[64]);
@@ -2973,9 +3443,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
             int h = (z->img_comp[n].y + 7) >> 3;
             for (j = 0; j < h; ++j) {
                 for (i = 0; i < w; ++i) {
-                    int ha = z->img_comp[n].ha;
-                    if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                    z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
+                    if (!stbi__jpeg_decode_baseline_mcu(z, data, i, j)) return 0;
                     // every data block is an MCU, so countdown the restart interval
                     if (--z->todo <= 0) {
                         if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2989,25 +3457,11 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
             return 1;
         }
         else { // interleaved
-            int i, j, k, x, y;
+            int i, j;
             STBI_SIMD_ALIGN(short, data[64]);
             for (j = 0; j < z->img_mcu_y; ++j) {
                 for (i = 0; i < z->img_mcu_x; ++i) {
-                    // scan an interleaved mcu... process scan_n components in order
-                    for (k = 0; k < z->scan_n; ++k) {
-                        int n = z->order[k];
-                        // scan out an mcu's worth of this component; that's just determined
-                        // by the basic H and V specified for the component
-                        for (y = 0; y < z->img_comp[n].v; ++y) {
-                            for (x = 0; x < z->img_comp[n].h; ++x) {
-                                int x2 = (i * z->img_comp[n].h + x) * 8;
-                                int y2 = (j * z->img_comp[n].v + y) * 8;
-                                int ha = z->img_comp[n].ha;
-                                if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                                z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2, z->img_comp[n].w2, data);
-                            }
-                        }
-                    }
+                    if (!stbi__jpeg_decode_baseline_mcu(z, data, i, j)) return 0;
                     // after all interleaved components, that's an interleaved MCU,
                     // so now count down the restart interval
                     if (--z->todo <= 0) {
@@ -3103,8 +3557,11 @@ static void stbi__jpeg_finish(stbi__jpeg* z)
             for (j = 0; j < h; ++j) {
                 for (i = 0; i < w; ++i) {
                     short* data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-                    stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-                    z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
+                    if (z->img_comp[n].dct_shift == 3)
+                        data[0] *= z->dequant[z->img_comp[n].tq][0]; // 1x1 blocks only read the DC term
+                    else
+                        stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
+                    z->img_comp[n].idct_kernel(z->img_comp[n].data + ((z->img_comp[n].w2 * j * 8 + i * 8) >> z->img_comp[n].dct_shift), z->img_comp[n].w2, data);
                 }
             }
         }
@@ -3279,6 +3736,22 @@ static int stbi__free_jpeg_components(stbi__jpeg* z, int ncomp, int why)
     return why;
 }
 
+// how far a scaled decode shrinks component i's blocks. a plane subsampled by
+// the same power of two in both directions shrinks that much less, like
+// libjpeg's DCT scaling, so its blocks come out at the output resolution with
+// nothing left to upsample: at 1/8 a 4:2:0 image decodes luma 1x1, chroma 2x2
+static int stbi__jpeg_dct_shift(stbi__jpeg* z, int i)
+{
+    int hs = z->img_h_max / z->img_comp[i].h, shift = z->scale_shift;
+    if (hs != z->img_v_max / z->img_comp[i].v)
+        return shift;
+    while (shift > 0 && (hs & 1) == 0) {
+        --shift;
+        hs >>= 1;
+    }
+    return shift;
+}
+
 static int stbi__process_frame_header(stbi__jpeg* z, int scan)
 {
     stbi__context* s = z->s;
@@ -3347,8 +3820,12 @@ static int stbi__process_frame_header(stbi__jpeg* z, int scan)
         //
         // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
         // so these muls can't overflow with 32-bit ints (which we require)
-        z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-        z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+        z->img_comp[i].dct_shift = stbi__jpeg_dct_shift(z, i);
+        z->img_comp[i].idct_kernel = z->img_comp[i].dct_shift == 3 ? stbi__idct_block_1x1
+            : z->img_comp[i].dct_shift == 2 ? stbi__idct_block_2x2
+            : z->img_comp[i].dct_shift == 1 ? stbi__idct_block_4x4 : z->idct_block_kernel;
+        z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->img_comp[i].dct_shift);
+        z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->img_comp[i].dct_shift);
         z->img_comp[i].coeff = 0;
         z->img_comp[i].raw_coeff = 0;
         z->img_comp[i].linebuf = NULL;
@@ -3358,10 +3835,10 @@ static int stbi__process_frame_header(stbi__jpeg* z, int scan)
         // align blocks for idct using mmx/sse
         z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
         if (z->progressive) {
-            // w2, h2 are multiples of 8 (see above)
-            z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-            z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-            z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+            // coefficients are kept in full for every block, whatever the output scale
+            z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+            z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+            z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
             if (z->img_comp[i].raw_coeff == NULL)
                 return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
             z->img_comp[i].coeff = (short*)(((size_t)z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3426,6 +3903,154 @@ static int stbi__skip_jpeg_junk_at_end(stbi__jpeg* j)
     return STBI__MARKER_none;
 }
 
+// restart intervals of a baseline scan, decoded through stbi__parallel_run
+typedef struct
+{
+    stbi__jpeg* z;
+    stbi_uc** start;   // first entropy-coded byte of each interval
+    stbi_uc* ok;       // per interval: 0 failed, 1 decoded up to its RSTn, 2 decoded with data left over
+    const char** why;  // per interval, the failure reason of the worker that decoded it
+    int mcus_x, mcus;
+} stbi__restart_job;
+
+static void stbi__decode_restart_intervals(void* data, int begin, int end)
+{
+    stbi__restart_job* job = (stbi__restart_job*)data;
+    // each range gets its own bit reader and DC predictors; the huffman and
+    // quantization tables are copied along with them, and only read
+    stbi__jpeg* z = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
+    stbi__context s;
+    STBI_SIMD_ALIGN(short, block[64]);
+    int r, m;
+    if (!z) return; // leaves the range failed with no reason, read as out of memory
+    memcpy(z, job->z, sizeof(stbi__jpeg));
+    // the buffer end stays where it is: the last interval has to run into the
+    // marker after the scan, as it does serially, not off the end into zeros
+    s = *job->z->s;
+    z->s = &s;
+    for (r = begin; r < end; ++r) {
+        int last = (r + 1) * z->restart_interval < job->mcus ? (r + 1) * z->restart_interval : job->mcus;
+        s.img_buffer = job->start[r];
+        stbi__jpeg_reset(z);
+        for (m = r * z->restart_interval; m < last; ++m)
+            if (!stbi__jpeg_decode_baseline_mcu(z, block, m % job->mcus_x, m / job->mcus_x)) break;
+        if (m < last) {
+            // the reason is thread-local, so hand it back to the calling thread
+            job->why[r] = stbi_failure_reason();
+            continue;
+        }
+        // the same check the serial decoder makes at the end of an interval
+        if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+        job->ok[r] = STBI__RESTART(z->marker) ? 1 : 2;
+    }
+    STBI_FREE(z);
+}
+
+// splits a baseline scan at its RSTn markers and decodes the intervals in
+// parallel. -1 if it can't: no parallel_for, no restart interval, a streamed
+// source, or markers that don't match the interval count, in which case the
+// scan is left untouched for the serial decoder
+static int stbi__parse_restart_intervals(stbi__jpeg* z)
+{
+    stbi__context* s = z->s;
+    stbi__restart_job job;
+    stbi_uc* p, * q;
+    int n = z->order[0], count, found, r, ok = 1;
+
+    if (!stbi__parallel_run || !z->restart_interval || s->read_from_callbacks) return -1;
+    job.mcus_x = z->scan_n == 1 ? (z->img_comp[n].x + 7) >> 3 : z->img_mcu_x;
+    job.mcus = job.mcus_x * (z->scan_n == 1 ? (z->img_comp[n].y + 7) >> 3 : z->img_mcu_y);
+    count = (job.mcus + z->restart_interval - 1) / z->restart_interval;
+    if (count < 2) return -1;
+
+    job.start = (stbi_uc**)stbi__malloc(sizeof(stbi_uc*) * count);
+    job.ok = (stbi_uc*)stbi__malloc(count);
+    job.why = (const char**)stbi__malloc(sizeof(const char*) * count);
+    if (!job.start || !job.ok || !job.why) {
+        STBI_FREE(job.start);
+        STBI_FREE(job.ok);
+        STBI_FREE(job.why);
+        return -1;
+    }
+
+    // find the intervals: 0xFF 0x00 is a stuffed data byte, 0xFF 0xDn the
+    // restart marker that starts the next interval, 0xFF anything else ends the scan
+    job.start[0] = p = s->img_buffer;
+    found = 1;
+    for (;;) {
+        p = (stbi_uc*)memchr(p, 0xff, s->img_buffer_end - p);
+        if (!p) {
+            p = s->img_buffer_end;
+            break;
+        }
+        for (q = p + 1; q < s->img_buffer_end && *q == 0xff; ++q) {}
+        if (q == s->img_buffer_end) {
+            p = q;
+            break;
+        }
+        if (*q == 0) {
+            p = q + 1;
+            continue;
+        }
+        if (!STBI__RESTART(*q)) break;
+        if (found == count || *q != 0xd0 + ((found - 1) & 7)) {
+            found = 0;
+            break;
+        }
+        job.start[found++] = p = q + 1;
+    }
+    if (found != count) {
+        STBI_FREE(job.start);
+        STBI_FREE(job.ok);
+        STBI_FREE(job.why);
+        return -1;
+    }
+
+    job.z = z;
+    memset(job.ok, 0, count);
+    memset((void*)job.why, 0, sizeof(const char*) * count);
+    stbi__parallel_run(stbi__parallel_user, count, stbi__decode_restart_intervals, &job);
+
+    // accept or reject the scan as the serial decoder would: it fails at the
+    // first interval that fails, and gives up without an error at the first
+    // one that ends short of its RSTn, never looking at the intervals after
+    // it. those have been decoded here all the same, so a corrupt image may
+    // come out with more of its pixels filled in than a serial decode
+    for (r = 0; r < count && job.ok[r] == 1; ++r) {}
+    if (r < count && !job.ok[r])
+        ok = job.why[r] ? stbi__err(job.why[r], job.why[r]) : stbi__err("outofmem", "Out of memory");
+    else if (r < count - 1)
+        p = job.start[r + 1] - 2; // the 0xFF of the RSTn it stopped short of
+    STBI_FREE(job.start);
+    STBI_FREE(job.ok);
+    STBI_FREE(job.why);
+
+    // carry on after the scan as the serial decoder would
+    s->img_buffer = p;
+    z->marker = STBI__MARKER_none;
+    return ok;
+}
+
+// a progressive AC scan whose components all decode to 1x1 blocks adds
+// nothing to the image, so a 1/8 decode steps over its data, restart markers
+// included, instead of entropy-decoding it
+static int stbi__jpeg_scan_unused(stbi__jpeg* j)
+{
+    int i;
+    if (!j->progressive || j->spec_start == 0) return 0;
+    for (i = 0; i < j->scan_n; ++i)
+        if (j->img_comp[j->order[i]].dct_shift != 3) return 0;
+    return 1;
+}
+
+static int stbi__skip_jpeg_scan(stbi__jpeg* j)
+{
+    int m;
+    do m = stbi__skip_jpeg_junk_at_end(j);
+    while (STBI__RESTART(m));
+    return m;
+}
+
 // decode image to YCbCr format
 static int stbi__decode_jpeg_image(stbi__jpeg* j)
 {
@@ -3440,7 +4065,9 @@ static int stbi__decode_jpeg_image(stbi__jpeg* j)
     while (!stbi__EOI(m)) {
         if (stbi__SOS(m)) {
             if (!stbi__process_scan_header(j)) return 0;
-            if (!stbi__parse_entropy_coded_data(j)) return 0;
+            if (stbi__jpeg_scan_unused(j))
+                j->marker = stbi__skip_jpeg_scan(j);
+            else if (!stbi__parse_entropy_coded_data(j)) return 0;
             if (j->marker == STBI__MARKER_none) {
                 j->marker = stbi__skip_jpeg_junk_at_end(j);
                 // if we reach eof without hitting a marker, stbi__get_marker() below will fail and we'll eventually return 0
@@ -3663,11 +4290,70 @@ static stbi_uc* stbi__resample_row_hv_2_simd(stbi_uc* out, stbi_uc* in_near, stb
 }
 #endif
 
-static stbi_uc* stbi__resample_row_generic(stbi_uc* out, stbi_uc* in_near, stbi_uc* in_far, int w, int hs)
+#ifdef STBI_SSE2
+// AVX2 version of stbi__resample_row_hv_2_simd: 16 input pixels per step, the
+// same arithmetic, so the same output
+STBI__TARGET_AVX2 static stbi_uc* stbi__resample_row_hv_2_avx2(stbi_uc* out, stbi_uc* in_near, stbi_uc* in_far, int w, int hs)
 {
-    // resample with nearest-neighbor
-    int i, j;
-    STBI_NOTUSED(in_far);
+    int i = 0, t0, t1;
+
+    if (w == 1) {
+        out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
+        return out;
+    }
+
+    t1 = 3 * in_near[0] + in_far[0];
+    for (; i < ((w - 1) & ~15); i += 16) {
+        // vertical pass: 3*near + far = 4*near + (far - near)
+        __m256i farw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (in_far + i)));
+        __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (in_near + i)));
+        __m256i curr = _mm256_add_epi16(_mm256_slli_epi16(nearw, 2), _mm256_sub_epi16(farw, nearw));
+
+        // "prev" and "next" are curr moved one pixel along all 16 lanes, which
+        // crosses the 128-bit halves: alignr against curr with one half swapped
+        // in, then the pixel before and after the block go in at the ends
+        __m256i lowup = _mm256_permute2x128_si256(curr, curr, 0x08); // [0 | curr.lo]
+        __m256i highdown = _mm256_permute2x128_si256(curr, curr, 0x81); // [curr.hi | 0]
+        __m256i prev = _mm256_insert_epi16(_mm256_alignr_epi8(curr, lowup, 14), t1, 0);
+        __m256i next = _mm256_insert_epi16(_mm256_alignr_epi8(highdown, curr, 2), 3 * in_near[i + 16] + in_far[i + 16], 15);
+
+        // horizontal pass, polyphase as in the SSE2 version
+        __m256i curb = _mm256_add_epi16(_mm256_slli_epi16(curr, 2), _mm256_set1_epi16(8));
+        __m256i even = _mm256_add_epi16(_mm256_sub_epi16(prev, curr), curb);
+        __m256i odd = _mm256_add_epi16(_mm256_sub_epi16(next, curr), curb);
+
+        // interleaving within each half keeps the output in order after the pack
+        __m256i de0 = _mm256_srli_epi16(_mm256_unpacklo_epi16(even, odd), 4);
+        __m256i de1 = _mm256_srli_epi16(_mm256_unpackhi_epi16(even, odd), 4);
+        _mm256_storeu_si256((__m256i*) (out + i * 2), _mm256_packus_epi16(de0, de1));
+
+        // "previous" value for next iter
+        t1 = 3 * in_near[i + 15] + in_far[i + 15];
+    }
+
+    t0 = t1;
+    t1 = 3 * in_near[i] + in_far[i];
+    out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+
+    for (++i; i < w; ++i) {
+        t0 = t1;
+        t1 = 3 * in_near[i] + in_far[i];
+        out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
+        out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+    }
+    out[w * 2 - 1] = stbi__div4(t1 + 2);
+
+    STBI_NOTUSED(hs);
+
+    return out;
+}
+#endif
+
+static stbi_uc* stbi__resample_row_generic(stbi_uc* out, stbi_uc* in_near, stbi_uc* in_far, int w, int hs)
+{
+    // resample with nearest-neighbor
+    int i, j;
+    STBI_NOTUSED(in_far);
     for (i = 0; i < w; ++i)
         for (j = 0; j < hs; ++j)
             out[i * hs + j] = in_near[i];
@@ -3837,6 +4523,70 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc* out, stbi_uc const* y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_SSE2
+// AVX2 version of stbi__YCbCr_to_RGB_simd, 16 pixels per step with the same
+// arithmetic. It also covers step == 3, which is what a native-component load
+// of a colour JPEG uses, by squeezing each half's four RGBA pixels down to 12
+// bytes; the tail goes to the SSE2 version.
+STBI__TARGET_AVX2 static void stbi__YCbCr_to_RGB_avx2(stbi_uc* out, stbi_uc const* y, stbi_uc const* pcb, stbi_uc const* pcr, int count, int step)
+{
+    int i = 0;
+    if (step == 4 || step == 3) {
+        __m128i signflip = _mm_set1_epi8(-0x80);
+        __m256i cr_const0 = _mm256_set1_epi16((short)(1.40200f * 4096.0f + 0.5f));
+        __m256i cr_const1 = _mm256_set1_epi16(-(short)(0.71414f * 4096.0f + 0.5f));
+        __m256i cb_const0 = _mm256_set1_epi16(-(short)(0.34414f * 4096.0f + 0.5f));
+        __m256i cb_const1 = _mm256_set1_epi16((short)(1.77200f * 4096.0f + 0.5f));
+        __m256i y_bias = _mm256_set1_epi16(128);
+        __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+        __m256i drop_alpha = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        // with step 3 each 16-byte store runs 4 bytes on, so keep 2 pixels back from the end
+        int last = step == 4 ? count - 16 : count - 18;
+
+        for (; i <= last; i += 16) {
+            // unpack to short: y << 8 | 128, and cr, cb re-centred then << 8
+            __m256i yw = _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (y + i))), 8), y_bias);
+            __m256i crw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_xor_si128(_mm_loadu_si128((const __m128i*) (pcr + i)), signflip)), 8);
+            __m256i cbw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_xor_si128(_mm_loadu_si128((const __m128i*) (pcb + i)), signflip)), 8);
+
+            // color transform
+            __m256i yws = _mm256_srli_epi16(yw, 4);
+            __m256i rws = _mm256_add_epi16(_mm256_mulhi_epi16(cr_const0, crw), yws);
+            __m256i gwt = _mm256_add_epi16(_mm256_mulhi_epi16(cb_const0, cbw), yws);
+            __m256i bws = _mm256_add_epi16(yws, _mm256_mulhi_epi16(cbw, cb_const1));
+            __m256i gws = _mm256_add_epi16(gwt, _mm256_mulhi_epi16(crw, cr_const1));
+
+            // descale, back to byte, transpose to interleave channels
+            __m256i brb = _mm256_packus_epi16(_mm256_srai_epi16(rws, 4), _mm256_srai_epi16(bws, 4));
+            __m256i gxb = _mm256_packus_epi16(_mm256_srai_epi16(gws, 4), xw);
+            __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+            __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+            __m256i o0 = _mm256_unpacklo_epi16(t0, t1); // pixels 0-3 | 8-11
+            __m256i o1 = _mm256_unpackhi_epi16(t0, t1); // pixels 4-7 | 12-15
+
+            if (step == 4) {
+                _mm256_storeu_si256((__m256i*) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+                _mm256_storeu_si256((__m256i*) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+                out += 64;
+            }
+            else {
+                // each store's last 4 bytes are overwritten by the next one
+                o0 = _mm256_shuffle_epi8(o0, drop_alpha);
+                o1 = _mm256_shuffle_epi8(o1, drop_alpha);
+                _mm_storeu_si128((__m128i*) (out + 0), _mm256_castsi256_si128(o0));
+                _mm_storeu_si128((__m128i*) (out + 12), _mm256_castsi256_si128(o1));
+                _mm_storeu_si128((__m128i*) (out + 24), _mm256_extracti128_si256(o0, 1));
+                _mm_storeu_si128((__m128i*) (out + 36), _mm256_extracti128_si256(o1, 1));
+                out += 48;
+            }
+        }
+    }
+    stbi__YCbCr_to_RGB_simd(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg* j)
 {
@@ -3845,11 +4595,16 @@ static void stbi__setup_jpeg(stbi__jpeg* j)
     j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
 #ifdef STBI_SSE2
-    if (stbi__sse2_available()) {
+    if (stbi__sse2_available() && stbi_simd_level() >= STBI_SIMD_SSE2) {
         j->idct_block_kernel = stbi__idct_simd;
         j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
         j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
     }
+    if (stbi_simd_level() >= STBI_SIMD_AVX2) {
+        j->idct_block_kernel = stbi__idct_avx2;
+        j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+        j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+    }
 #endif
 
 #ifdef STBI_NEON
@@ -3882,6 +4637,170 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
     return (stbi_uc)((t + (t >> 8)) >> 8);
 }
 
+typedef struct
+{
+    stbi__jpeg* z;
+    const stbi__resample* res_comp; // resamplers as they start row 0
+    stbi_uc* output;
+    int n, decode_n, is_rgb;
+    int failed; // set by a task that couldn't allocate its line buffers
+} stbi__jpeg_rows;
+
+// resamples and color-converts output rows [j0, j1) using linebuf[k] as
+// component k's scratch row. the resamplers are copied and stepped forward to
+// j0, so separate ranges can run concurrently. with 3 components every row is
+// written one byte long; if last_row is set, row j1-1 goes there first so the
+// overrun can't land on another range's first row
+static void stbi__jpeg_convert_rows(stbi__jpeg_rows* rows, stbi_uc* linebuf[4], stbi_uc* last_row, unsigned int j0, unsigned int j1)
+{
+    stbi__jpeg* z = rows->z;
+    int k, n = rows->n, decode_n = rows->decode_n, is_rgb = rows->is_rgb;
+    unsigned int i, j;
+    stbi_uc* output = rows->output;
+    stbi_uc* coutput[4] = { NULL, NULL, NULL, NULL };
+    stbi__resample res_comp[4];
+
+    for (k = 0; k < decode_n; ++k) {
+        stbi__resample* r = &res_comp[k];
+        *r = rows->res_comp[k];
+        for (j = 0; j < j0; ++j) {
+            if (++r->ystep >= r->vs) {
+                r->ystep = 0;
+                r->line0 = r->line1;
+                if (++r->ypos < z->img_comp[k].y)
+                    r->line1 += z->img_comp[k].w2;
+            }
+        }
+    }
+
+    for (j = j0; j < j1; ++j) {
+        stbi_uc* out = last_row && j + 1 == j1 ? last_row : output + n * z->s->img_x * j;
+        for (k = 0; k < decode_n; ++k) {
+            stbi__resample* r = &res_comp[k];
+            int y_bot = r->ystep >= (r->vs >> 1);
+            coutput[k] = r->resample(linebuf[k],
+                y_bot ? r->line1 : r->line0,
+                y_bot ? r->line0 : r->line1,
+                r->w_lores, r->hs);
+            if (++r->ystep >= r->vs) {
+                r->ystep = 0;
+                r->line0 = r->line1;
+                if (++r->ypos < z->img_comp[k].y)
+                    r->line1 += z->img_comp[k].w2;
+            }
+        }
+        if (n >= 3) {
+            stbi_uc* y = coutput[0];
+            if (z->s->img_n == 3) {
+                if (is_rgb) {
+                    for (i = 0; i < z->s->img_x; ++i) {
+                        out[0] = y[i];
+                        out[1] = coutput[1][i];
+                        out[2] = coutput[2][i];
+                        out[3] = 255;
+                        out += n;
+                    }
+                }
+                else {
+                    z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+                }
+            }
+            else if (z->s->img_n == 4) {
+                if (z->app14_color_transform == 0) { // CMYK
+                    for (i = 0; i < z->s->img_x; ++i) {
+                        stbi_uc m = coutput[3][i];
+                        out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                        out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                        out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                        out[3] = 255;
+                        out += n;
+                    }
+                }
+                else if (z->app14_color_transform == 2) { // YCCK
+                    z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+                    for (i = 0; i < z->s->img_x; ++i) {
+                        stbi_uc m = coutput[3][i];
+                        out[0] = stbi__blinn_8x8(255 - out[0], m);
+                        out[1] = stbi__blinn_8x8(255 - out[1], m);
+                        out[2] = stbi__blinn_8x8(255 - out[2], m);
+                        out += n;
+                    }
+                }
+                else { // YCbCr + alpha?  Ignore the fourth channel for now
+                    z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+                }
+            }
+            else
+                for (i = 0; i < z->s->img_x; ++i) {
+                    out[0] = out[1] = out[2] = y[i];
+                    out[3] = 255; // not used if n==3
+                    out += n;
+                }
+        }
+        else {
+            if (is_rgb) {
+                if (n == 1)
+                    for (i = 0; i < z->s->img_x; ++i)
+                        *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                else {
+                    for (i = 0; i < z->s->img_x; ++i, out += 2) {
+                        out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                        out[1] = 255;
+                    }
+                }
+            }
+            else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+                for (i = 0; i < z->s->img_x; ++i) {
+                    stbi_uc m = coutput[3][i];
+                    stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+                    stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+                    stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+                    out[0] = stbi__compute_y(r, g, b);
+                    out[1] = 255;
+                    out += n;
+                }
+            }
+            else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+                for (i = 0; i < z->s->img_x; ++i) {
+                    out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+                    out[1] = 255;
+                    out += n;
+                }
+            }
+            else {
+                stbi_uc* y = coutput[0];
+                if (n == 1)
+                    for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
+                else
+                    for (i = 0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+            }
+        }
+    }
+    if (last_row && j0 < j1)
+        memcpy(output + n * z->s->img_x * (j1 - 1), last_row, n * z->s->img_x);
+}
+
+// stbi_parallel_task over output rows; each range has its own line buffers
+static void stbi__jpeg_convert_task(void* data, int begin, int end)
+{
+    stbi__jpeg_rows* rows = (stbi__jpeg_rows*)data;
+    stbi_uc* linebuf[4] = { NULL, NULL, NULL, NULL };
+    stbi_uc* last_row = (stbi_uc*)stbi__malloc_mad2(rows->n, rows->z->s->img_x, 1);
+    int k, ok = last_row != NULL;
+    for (k = 0; k < rows->decode_n; ++k) {
+        // big enough for upsampling off the edges with upsample factor of 4
+        linebuf[k] = (stbi_uc*)stbi__malloc(rows->z->s->img_x + 3);
+        ok = ok && linebuf[k];
+    }
+    if (ok)
+        stbi__jpeg_convert_rows(rows, linebuf, last_row, begin, end);
+    else
+        rows->failed = 1;
+    for (k = 0; k < rows->decode_n; ++k)
+        STBI_FREE(linebuf[k]);
+    STBI_FREE(last_row);
+}
+
 static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y, int* comp, int req_comp)
 {
     int n, decode_n, is_rgb;
@@ -3893,6 +4812,20 @@ static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y, int* comp
     // load a jpeg image from whichever source, but leave in YCbCr format
     if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+    // a scaled decode shrank every plane by its dct_shift; planes that shrank
+    // less than the image now have correspondingly less to upsample
+    if (z->scale_shift) {
+        z->s->img_x = (z->s->img_x + (1 << z->scale_shift) - 1) >> z->scale_shift;
+        z->s->img_y = (z->s->img_y + (1 << z->scale_shift) - 1) >> z->scale_shift;
+        for (n = 0; n < z->s->img_n; ++n) {
+            int shift = z->img_comp[n].dct_shift;
+            z->img_comp[n].x = (z->img_comp[n].x + (1 << shift) - 1) >> shift;
+            z->img_comp[n].y = (z->img_comp[n].y + (1 << shift) - 1) >> shift;
+            z->img_comp[n].h <<= z->scale_shift - shift;
+            z->img_comp[n].v <<= z->scale_shift - shift;
+        }
+    }
+
     // determine actual number of components to generate
     n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -3910,9 +4843,8 @@ static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y, int* comp
     // resample and color-convert
     {
         int k;
-        unsigned int i, j;
         stbi_uc* output;
-        stbi_uc* coutput[4] = { NULL, NULL, NULL, NULL };
+        stbi__jpeg_rows rows;
 
         stbi__resample res_comp[4];
 
@@ -3938,113 +4870,29 @@ static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y, int* comp
             else                               r->resample = stbi__resample_row_generic;
         }
 
-        // can't error after this so, this is safe
+        // only the parallel path's line buffers can fail after this
         output = (stbi_uc*)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
         if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
-        // now go ahead and resample
-        for (j = 0; j < z->s->img_y; ++j) {
-            stbi_uc* out = output + n * z->s->img_x * j;
-            for (k = 0; k < decode_n; ++k) {
-                stbi__resample* r = &res_comp[k];
-                int y_bot = r->ystep >= (r->vs >> 1);
-                coutput[k] = r->resample(z->img_comp[k].linebuf,
-                    y_bot ? r->line1 : r->line0,
-                    y_bot ? r->line0 : r->line1,
-                    r->w_lores, r->hs);
-                if (++r->ystep >= r->vs) {
-                    r->ystep = 0;
-                    r->line0 = r->line1;
-                    if (++r->ypos < z->img_comp[k].y)
-                        r->line1 += z->img_comp[k].w2;
-                }
-            }
-            if (n >= 3) {
-                stbi_uc* y = coutput[0];
-                if (z->s->img_n == 3) {
-                    if (is_rgb) {
-                        for (i = 0; i < z->s->img_x; ++i) {
-                            out[0] = y[i];
-                            out[1] = coutput[1][i];
-                            out[2] = coutput[2][i];
-                            out[3] = 255;
-                            out += n;
-                        }
-                    }
-                    else {
-                        z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                    }
-                }
-                else if (z->s->img_n == 4) {
-                    if (z->app14_color_transform == 0) { // CMYK
-                        for (i = 0; i < z->s->img_x; ++i) {
-                            stbi_uc m = coutput[3][i];
-                            out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                            out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                            out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                            out[3] = 255;
-                            out += n;
-                        }
-                    }
-                    else if (z->app14_color_transform == 2) { // YCCK
-                        z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                        for (i = 0; i < z->s->img_x; ++i) {
-                            stbi_uc m = coutput[3][i];
-                            out[0] = stbi__blinn_8x8(255 - out[0], m);
-                            out[1] = stbi__blinn_8x8(255 - out[1], m);
-                            out[2] = stbi__blinn_8x8(255 - out[2], m);
-                            out += n;
-                        }
-                    }
-                    else { // YCbCr + alpha?  Ignore the fourth channel for now
-                        z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                    }
-                }
-                else
-                    for (i = 0; i < z->s->img_x; ++i) {
-                        out[0] = out[1] = out[2] = y[i];
-                        out[3] = 255; // not used if n==3
-                        out += n;
-                    }
-            }
-            else {
-                if (is_rgb) {
-                    if (n == 1)
-                        for (i = 0; i < z->s->img_x; ++i)
-                            *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                    else {
-                        for (i = 0; i < z->s->img_x; ++i, out += 2) {
-                            out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                            out[1] = 255;
-                        }
-                    }
-                }
-                else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-                    for (i = 0; i < z->s->img_x; ++i) {
-                        stbi_uc m = coutput[3][i];
-                        stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                        stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                        stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                        out[0] = stbi__compute_y(r, g, b);
-                        out[1] = 255;
-                        out += n;
-                    }
-                }
-                else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-                    for (i = 0; i < z->s->img_x; ++i) {
-                        out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                        out[1] = 255;
-                        out += n;
-                    }
-                }
-                else {
-                    stbi_uc* y = coutput[0];
-                    if (n == 1)
-                        for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
-                    else
-                        for (i = 0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-                }
-            }
+        // now go ahead and resample, in parallel if there's a pool and enough rows
+        rows.z = z;
+        rows.res_comp = res_comp;
+        rows.output = output;
+        rows.n = n;
+        rows.decode_n = decode_n;
+        rows.is_rgb = is_rgb;
+        rows.failed = 0;
+        if (stbi__parallel_run && (stbi__uint32)z->s->img_x * z->s->img_y >= 65536)
+            stbi__parallel_run(stbi__parallel_user, z->s->img_y, stbi__jpeg_convert_task, &rows);
+        else {
+            stbi_uc* linebuf[4];
+            for (k = 0; k < 4; ++k) linebuf[k] = z->img_comp[k].linebuf;
+            stbi__jpeg_convert_rows(&rows, linebuf, NULL, 0, z->s->img_y);
+        }
+        if (rows.failed) {
+            STBI_FREE(output);
+            stbi__cleanup_jpeg(z);
+            return stbi__errpuc("outofmem", "Out of memory");
         }
         stbi__cleanup_jpeg(z);
         *out_x = z->s->img_x;
@@ -4060,9 +4908,10 @@ static void* stbi__jpeg_load(stbi__context* s, int* x, int* y, int* comp, int re
     stbi__jpeg* j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
     if (!j) return stbi__errpuc("outofmem", "Out of memory");
     memset(j, 0, sizeof(stbi__jpeg));
-    STBI_NOTUSED(ri);
     j->s = s;
+    j->scale_shift = s->scale_shift;
     stbi__setup_jpeg(j);
+    ri->scale_shift = j->scale_shift;
     result = load_jpeg_image(j, x, y, comp, req_comp);
     STBI_FREE(j);
     return result;
@@ -4121,6 +4970,31 @@ static int stbi__jpeg_info(stbi__context* s, int* x, int* y, int* comp)
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 #define STBI__ZNSYMS 288 // number of symbols in literal/length alphabet
 
+#ifndef STBI_NO_FAST_INFLATE
+#define STBI__FAST_INFLATE
+// table-driven inflate: an 11-bit root table for literal/length codes and an
+// 8-bit one for distances, with subtables for longer codes; ENOUGH is the
+// worst-case size of root plus subtables for any valid code (zlib's enough.c)
+#define STBI__ZLITLEN_BITS   11
+#define STBI__ZLITLEN_ENOUGH 2342
+#define STBI__ZDIST_BITS     8
+#define STBI__ZDIST_ENOUGH   402
+// entry = payload << 16 | extra bits << 12 | kind << 8 | bits consumed; the
+// payload is the literal(s), the length or distance base, or the subtable start
+enum {
+    STBI__ZK_INVALID, STBI__ZK_LITERAL, STBI__ZK_LITERAL_PAIR, STBI__ZK_END, STBI__ZK_MATCH, STBI__ZK_SUBTABLE
+};
+#if defined(_MSC_VER)
+typedef unsigned __int64 stbi__zbits;
+#else
+typedef uint64_t stbi__zbits;
+#endif
+#define STBI__ZFILL_LIMIT 48 // refill byte by byte while at most this many bits are held
+#else
+typedef stbi__uint32 stbi__zbits;
+#define STBI__ZFILL_LIMIT 24
+#endif
+
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
@@ -4207,14 +5081,19 @@ typedef struct
 {
     stbi_uc* zbuffer, * zbuffer_end;
     int num_bits;
-    stbi__uint32 code_buffer;
+    stbi__zbits code_buffer;
 
     char* zout;
     char* zout_start;
     char* zout_end;
     int   z_expandable;
 
+#ifdef STBI__FAST_INFLATE
+    stbi__uint32 z_litlen[STBI__ZLITLEN_ENOUGH];
+    stbi__uint32 z_dist[STBI__ZDIST_ENOUGH];
+#else
     stbi__zhuffman z_length, z_distance;
+#endif
 } stbi__zbuf;
 
 stbi_inline static int stbi__zeof(stbi__zbuf* z)
@@ -4230,20 +5109,20 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf* z)
 static void stbi__fill_bits(stbi__zbuf* z)
 {
     do {
-        if (z->code_buffer >= (1U << z->num_bits)) {
+        if (z->code_buffer >= ((stbi__zbits)1 << z->num_bits)) {
             z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
             return;
         }
-        z->code_buffer |= (unsigned int)stbi__zget8(z) << z->num_bits;
+        z->code_buffer |= (stbi__zbits)stbi__zget8(z) << z->num_bits;
         z->num_bits += 8;
-    } while (z->num_bits <= 24);
+    } while (z->num_bits <= STBI__ZFILL_LIMIT);
 }
 
 stbi_inline static unsigned int stbi__zreceive(stbi__zbuf* z, int n)
 {
     unsigned int k;
     if (z->num_bits < n) stbi__fill_bits(z);
-    k = z->code_buffer & ((1 << n) - 1);
+    k = (unsigned int)(z->code_buffer & ((1 << n) - 1));
     z->code_buffer >>= n;
     z->num_bits -= n;
     return k;
@@ -4254,7 +5133,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf* a, stbi__zhuffman* z)
     int b, s, k;
     // not resolved by fast table, so compute it the slow way
     // use jpeg approach, which requires MSbits at top
-    k = stbi__bit_reverse(a->code_buffer, 16);
+    k = stbi__bit_reverse((int)(a->code_buffer & 0xffff), 16);
     for (s = STBI__ZFAST_BITS + 1; ; ++s)
         if (k < z->maxcode[s])
             break;
@@ -4323,6 +5202,7 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
 
+#ifndef STBI__FAST_INFLATE
 static int stbi__parse_huffman_block(stbi__zbuf* a)
 {
     char* zout = a->zout;
@@ -4368,6 +5248,265 @@ static int stbi__parse_huffman_block(stbi__zbuf* a)
     }
 }
 
+#endif
+
+#ifdef STBI__FAST_INFLATE
+stbi_inline static stbi__zbits stbi__zload64(const stbi_uc* p)
+{
+#if defined(_MSC_VER) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    stbi__zbits v;
+    memcpy(&v, p, 8);
+    return v;
+#else
+    stbi__zbits v = 0;
+    int i;
+    for (i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+#endif
+}
+
+// table entry for symbol sym when codebits of its code are still unread at this table level
+static stbi__uint32 stbi__zfast_entry(int litlen, int sym, int codebits)
+{
+    stbi__uint32 base, extra;
+    if (litlen) {
+        if (sym < 256) return ((stbi__uint32)sym << 16) | (STBI__ZK_LITERAL << 8) | codebits;
+        if (sym == 256) return (STBI__ZK_END << 8) | codebits;
+        if (sym >= 286) return 0; // per DEFLATE, length codes 286 and 287 must not appear in compressed data
+        base = stbi__zlength_base[sym - 257];
+        extra = stbi__zlength_extra[sym - 257];
+    }
+    else {
+        if (sym >= 30) return 0; // per DEFLATE, distance codes 30 and 31 must not appear in compressed data
+        base = stbi__zdist_base[sym];
+        extra = stbi__zdist_extra[sym];
+    }
+    return (base << 16) | (extra << 12) | (STBI__ZK_MATCH << 8) | (codebits + extra);
+}
+
+// Builds a root table of 1 << bits entries indexed by the next input bits,
+// followed by one subtable per root prefix shared by longer codes. Every code
+// is replicated over the index bits it does not use; unused slots stay invalid.
+static int stbi__zbuild_fast(stbi__uint32* table, int bits, int enough, const stbi_uc* sizelist, int num, int litlen)
+{
+    int i, j, code, sizes[17], next_code[16], next;
+    stbi__uint16 codes[STBI__ZNSYMS];
+    stbi_uc sub_bits[1 << STBI__ZLITLEN_BITS];
+    int mask = (1 << bits) - 1;
+
+    // DEFLATE spec for generating codes, with the same validation as stbi__zbuild_huffman
+    memset(sizes, 0, sizeof(sizes));
+    for (i = 0; i < num; ++i)
+        ++sizes[sizelist[i]];
+    sizes[0] = 0;
+    for (i = 1; i < 16; ++i)
+        if (sizes[i] > (1 << i))
+            return stbi__err("bad sizes", "Corrupt PNG");
+    code = 0;
+    for (i = 1; i < 16; ++i) {
+        next_code[i] = code;
+        code = (code + sizes[i]);
+        if (sizes[i])
+            if (code - 1 >= (1 << i)) return stbi__err("bad codelengths", "Corrupt PNG");
+        code <<= 1;
+    }
+    for (i = 0; i < num; ++i)
+        if (sizelist[i])
+            codes[i] = (stbi__uint16)stbi__bit_reverse(next_code[sizelist[i]]++, sizelist[i]);
+
+    // a subtable per root prefix is as deep as the longest code sharing it
+    memset(table, 0, sizeof(stbi__uint32) << bits);
+    memset(sub_bits, 0, (size_t)1 << bits);
+    for (i = 0; i < num; ++i)
+        if (sizelist[i] > bits && sizelist[i] - bits > sub_bits[codes[i] & mask])
+            sub_bits[codes[i] & mask] = (stbi_uc)(sizelist[i] - bits);
+    next = 1 << bits;
+    for (i = 0; i <= mask; ++i) {
+        if (!sub_bits[i]) continue;
+        if (next + (1 << sub_bits[i]) > enough) return stbi__err("bad codelengths", "Corrupt PNG");
+        table[i] = ((stbi__uint32)next << 16) | ((stbi__uint32)sub_bits[i] << 12) | (STBI__ZK_SUBTABLE << 8) | bits;
+        memset(table + next, 0, sizeof(stbi__uint32) << sub_bits[i]);
+        next += 1 << sub_bits[i];
+    }
+
+    for (i = 0; i < num; ++i) {
+        int s = sizelist[i];
+        if (!s) continue;
+        if (s <= bits) {
+            stbi__uint32 e = stbi__zfast_entry(litlen, i, s);
+            for (j = codes[i]; j <= mask; j += 1 << s)
+                table[j] = e;
+        }
+        else {
+            stbi__uint32 e = stbi__zfast_entry(litlen, i, s - bits);
+            stbi__uint32* sub = table + (table[codes[i] & mask] >> 16);
+            for (j = codes[i] >> bits; j < (1 << sub_bits[codes[i] & mask]); j += 1 << (s - bits))
+                sub[j] = e;
+        }
+    }
+
+    // where a literal's code leaves room in the index for a whole second literal
+    // code, resolve both at once; going down, table[i >> len] is still single
+    if (litlen) {
+        for (i = mask; i >= 0; --i) {
+            stbi__uint32 e = table[i], e2;
+            int len = e & 0xff;
+            if (((e >> 8) & 15) != STBI__ZK_LITERAL || len >= bits) continue;
+            e2 = table[i >> len];
+            if (((e2 >> 8) & 15) == STBI__ZK_LITERAL && len + (int)(e2 & 0xff) <= bits)
+                table[i] = ((e >> 16) << 16) | ((e2 >> 16) << 24) | (STBI__ZK_LITERAL_PAIR << 8) | (len + (e2 & 0xff));
+        }
+    }
+    return 1;
+}
+
+static int stbi__parse_huffman_block(stbi__zbuf* a)
+{
+    stbi_uc* out = (stbi_uc*)a->zout;
+    stbi_uc* in = a->zbuffer;
+    stbi_uc* in_end = a->zbuffer_end;
+    stbi__zbits bits = a->code_buffer;
+    int num = a->num_bits, overrun = 0;
+    for (;;) {
+        stbi__uint32 entry, kind, extra;
+        int length, dist;
+        stbi_uc* src;
+
+        // hold at least 56 bits, enough for a length and a distance with their
+        // extra bits. Away from the end 8 bytes are loaded at once; bits above
+        // num then hold the bytes at in, which the next load puts back unchanged.
+        // Within 8 bytes of the end, bytes go in one at a time, zeros past it.
+        if (in_end - in >= 8) {
+            bits |= stbi__zload64(in) << num;
+            in += (63 - num) >> 3;
+            num |= 56;
+        }
+        else {
+            while (num < 56) {
+                if (in < in_end) bits |= (stbi__zbits)*in++ << num;
+                else if (++overrun > 8) return stbi__err("unexpected end", "Corrupt PNG");
+                num += 8;
+            }
+        }
+
+        entry = a->z_litlen[bits & ((1 << STBI__ZLITLEN_BITS) - 1)];
+        if (((entry >> 8) & 15) == STBI__ZK_SUBTABLE) {
+            bits >>= STBI__ZLITLEN_BITS;
+            num -= STBI__ZLITLEN_BITS;
+            entry = a->z_litlen[(entry >> 16) + (bits & ((1u << ((entry >> 12) & 15)) - 1))];
+        }
+        kind = (entry >> 8) & 15;
+        if (kind == STBI__ZK_LITERAL || kind == STBI__ZK_LITERAL_PAIR) {
+            // 56 bits cover three literal codes, so up to two more root-table
+            // literals follow without a refill; anything else goes round again
+            int run = 3;
+            for (;;) {
+                bits >>= entry & 0xff;
+                num -= entry & 0xff;
+                if (a->zout_end - (char*)out < 2) { // may not fit two: store exactly kind bytes
+                    if (a->zout_end - (char*)out < (int)kind) {
+                        if (!stbi__zexpand(a, (char*)out, kind)) return 0;
+                        out = (stbi_uc*)a->zout;
+                    }
+                    *out++ = (stbi_uc)(entry >> 16);
+                    if (kind == STBI__ZK_LITERAL_PAIR) *out++ = (stbi_uc)(entry >> 24);
+                }
+                else {
+                    out[0] = (stbi_uc)(entry >> 16);
+                    out[1] = (stbi_uc)(entry >> 24);
+                    out += kind; // 1 or 2 literals
+                }
+                if (--run == 0) break;
+                entry = a->z_litlen[bits & ((1 << STBI__ZLITLEN_BITS) - 1)];
+                kind = (entry >> 8) & 15;
+                if (kind != STBI__ZK_LITERAL && kind != STBI__ZK_LITERAL_PAIR) break;
+            }
+            continue;
+        }
+        if (kind == STBI__ZK_END) {
+            bits >>= entry & 0xff;
+            num -= entry & 0xff;
+            break;
+        }
+        if (kind != STBI__ZK_MATCH) return stbi__err("bad huffman code", "Corrupt PNG");
+
+        // length base and extra bits, then the same for the distance
+        extra = (entry >> 12) & 15;
+        length = (int)(entry >> 16) + (int)((bits >> ((entry & 0xff) - extra)) & ((1u << extra) - 1));
+        bits >>= entry & 0xff;
+        num -= entry & 0xff;
+        entry = a->z_dist[bits & ((1 << STBI__ZDIST_BITS) - 1)];
+        if (((entry >> 8) & 15) == STBI__ZK_SUBTABLE) {
+            bits >>= STBI__ZDIST_BITS;
+            num -= STBI__ZDIST_BITS;
+            entry = a->z_dist[(entry >> 16) + (bits & ((1u << ((entry >> 12) & 15)) - 1))];
+        }
+        if (((entry >> 8) & 15) != STBI__ZK_MATCH) return stbi__err("bad huffman code", "Corrupt PNG");
+        extra = (entry >> 12) & 15;
+        dist = (int)(entry >> 16) + (int)((bits >> ((entry & 0xff) - extra)) & ((1u << extra) - 1));
+        bits >>= entry & 0xff;
+        num -= entry & 0xff;
+
+        if ((char*)out - a->zout_start < dist) return stbi__err("bad dist", "Corrupt PNG");
+        if ((char*)out + length > a->zout_end) {
+            if (!stbi__zexpand(a, (char*)out, length)) return 0;
+            out = (stbi_uc*)a->zout;
+        }
+        src = out - dist;
+        if (dist == 1) { // run of one byte; common in images.
+            memset(out, *src, length);
+            out += length;
+        }
+        else if (a->zout_end - (char*)out >= length + 16) {
+            // 16 bytes per step, overrunning the match by up to 15 bytes that
+            // later output replaces. Below 8 bytes apart the source would overlap
+            // the 8-byte copies, so the first copies of the repeating pattern go
+            // byte by byte until the same bytes recur at least 8 back.
+            stbi_uc* end = out + length;
+            if (dist < 8) {
+                int period = dist * ((7 + dist) / dist);
+                stbi_uc* stop = out + (length < period ? length : period);
+                while (out < stop) *out++ = *src++;
+                src = out - period;
+            }
+            while (out < end) {
+                memcpy(out, src, 8);
+                memcpy(out + 8, src + 8, 8);
+                out += 16;
+                src += 16;
+            }
+            out = end;
+        }
+        else {
+            do *out++ = *src++; while (--length);
+        }
+    }
+
+    // drop the zeros added past the end, and the look-ahead above num, so the
+    // byte-at-a-time readers of stored blocks and block headers take over cleanly.
+    // Fewer bits left than zeros added means codes were decoded from the zeros
+    if (num < overrun * 8) return stbi__err("unexpected end", "Corrupt PNG");
+    num -= overrun * 8;
+    a->code_buffer = bits & (((stbi__zbits)1 << num) - 1);
+    a->num_bits = num;
+    a->zbuffer = in;
+    a->zout = (char*)out;
+    return 1;
+}
+#endif
+
+static int stbi__zbuild_block_codes(stbi__zbuf* a, const stbi_uc* litlen_sizes, int hlit, const stbi_uc* dist_sizes, int hdist)
+{
+#ifdef STBI__FAST_INFLATE
+    if (!stbi__zbuild_fast(a->z_litlen, STBI__ZLITLEN_BITS, STBI__ZLITLEN_ENOUGH, litlen_sizes, hlit, 1)) return 0;
+    if (!stbi__zbuild_fast(a->z_dist, STBI__ZDIST_BITS, STBI__ZDIST_ENOUGH, dist_sizes, hdist, 0)) return 0;
+#else
+    if (!stbi__zbuild_huffman(&a->z_length, litlen_sizes, hlit)) return 0;
+    if (!stbi__zbuild_huffman(&a->z_distance, dist_sizes, hdist)) return 0;
+#endif
+    return 1;
+}
+
 static int stbi__compute_huffman_codes(stbi__zbuf* a)
 {
     static const stbi_uc length_dezigzag[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
@@ -4416,15 +5555,13 @@ static int stbi__compute_huffman_codes(stbi__zbuf* a)
         }
     }
     if (n != ntot) return stbi__err("bad codelengths", "Corrupt PNG");
-    if (!stbi__zbuild_huffman(&a->z_length, lencodes, hlit)) return 0;
-    if (!stbi__zbuild_huffman(&a->z_distance, lencodes + hlit, hdist)) return 0;
-    return 1;
+    return stbi__zbuild_block_codes(a, lencodes, hlit, lencodes + hlit, hdist);
 }
 
 static int stbi__parse_uncompressed_block(stbi__zbuf* a)
 {
-    stbi_uc header[4];
-    int len, nlen, k;
+    stbi_uc header[sizeof(stbi__zbits)];
+    int len, nlen, k, spare;
     if (a->num_bits & 7)
         stbi__zreceive(a, a->num_bits & 7); // discard
     // drain the bit-packed data into header
@@ -4441,11 +5578,22 @@ static int stbi__parse_uncompressed_block(stbi__zbuf* a)
     len = header[1] * 256 + header[0];
     nlen = header[3] * 256 + header[2];
     if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt", "Corrupt PNG");
-    if (a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer", "Corrupt PNG");
+    // a 64-bit bit buffer can hold bytes past the header: they start the stored
+    // data, and any beyond it go back for the next block header
+    spare = k - 4;
+    if (spare > len) {
+        for (k = k - 1; k >= 4 + len; --k) {
+            a->code_buffer = (a->code_buffer << 8) | header[k];
+            a->num_bits += 8;
+        }
+        spare = len;
+    }
+    if (a->zbuffer + (len - spare) > a->zbuffer_end) return stbi__err("read past buffer", "Corrupt PNG");
     if (a->zout + len > a->zout_end)
         if (!stbi__zexpand(a, a->zout, len)) return 0;
-    memcpy(a->zout, a->zbuffer, len);
-    a->zbuffer += len;
+    memcpy(a->zout, header + 4, spare);
+    memcpy(a->zout + spare, a->zbuffer, len - spare);
+    a->zbuffer += len - spare;
     a->zout += len;
     return 1;
 }
@@ -4512,8 +5660,7 @@ static int stbi__parse_zlib(stbi__zbuf* a, int parse_header)
         else {
             if (type == 1) {
                 // use fixed code lengths
-                if (!stbi__zbuild_huffman(&a->z_length, stbi__zdefault_length, STBI__ZNSYMS)) return 0;
-                if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance, 32)) return 0;
+                if (!stbi__zbuild_block_codes(a, stbi__zdefault_length, STBI__ZNSYMS, stbi__zdefault_distance, 32)) return 0;
             }
             else {
                 if (!stbi__compute_huffman_codes(a)) return 0;
@@ -4686,6 +5833,146 @@ static int stbi__paeth(int a, int b, int c)
     return c;
 }
 
+#ifdef STBI_SSE2
+// SIMD row unfiltering. Filters work on bytes whatever the bit depth, with the
+// left neighbour filter_bytes back. Up has no dependency between bytes and
+// runs 16 or 32 at a time; Sub becomes a prefix sum over four pixels per
+// register; Avg and Paeth need the finished pixel to their left, so they run
+// one pixel per register with all of its 3 or 4 channels at once. Each kernel
+// returns how many bytes of the row it wrote, the scalar loop does the rest,
+// and neither loads nor stores go past the row's nk bytes.
+static int stbi__load32(const stbi_uc* p)
+{
+    int v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// the pixel at p, in the low bpp bytes; a row's last pixel can end the buffer
+static int stbi__load_pixel(const stbi_uc* p, int bpp)
+{
+    return bpp == 4 ? stbi__load32(p) : p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static int stbi__unfilter_up_sse2(stbi_uc* cur, const stbi_uc* prior, const stbi_uc* raw, int nk)
+{
+    int k = 0;
+    for (; k + 16 <= nk; k += 16)
+        _mm_storeu_si128((__m128i*)(cur + k), _mm_add_epi8(_mm_loadu_si128((const __m128i*)(raw + k)), _mm_loadu_si128((const __m128i*)(prior + k))));
+    return k;
+}
+
+STBI__TARGET_AVX2 static int stbi__unfilter_up_avx2(stbi_uc* cur, const stbi_uc* prior, const stbi_uc* raw, int nk)
+{
+    int k = 0;
+    for (; k + 32 <= nk; k += 32)
+        _mm256_storeu_si256((__m256i*)(cur + k), _mm256_add_epi8(_mm256_loadu_si256((const __m256i*)(raw + k)), _mm256_loadu_si256((const __m256i*)(prior + k))));
+    return k;
+}
+
+static int stbi__unfilter_sub_sse2(stbi_uc* cur, const stbi_uc* raw, int nk, int bpp)
+{
+    // a holds the pixel to the left in its low bytes; adding it to the first
+    // pixel before the prefix sum carries it along the whole register
+    int k = 0;
+    __m128i a = _mm_cvtsi32_si128(stbi__load_pixel(cur - bpp, bpp));
+    if (bpp == 4) {
+        for (; k + 16 <= nk; k += 16) {
+            __m128i x = _mm_add_epi8(_mm_loadu_si128((const __m128i*)(raw + k)), a);
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+            _mm_storeu_si128((__m128i*)(cur + k), x);
+            a = _mm_srli_si128(x, 12);
+        }
+    }
+    else {
+        // four pixels in the low 12 bytes; the top four are rewritten by the next step
+        const __m128i mask = _mm_cvtsi32_si128(0xFFFFFF);
+        for (; k + 16 <= nk; k += 12) {
+            __m128i x = _mm_add_epi8(_mm_loadu_si128((const __m128i*)(raw + k)), a);
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+            _mm_storeu_si128((__m128i*)(cur + k), x);
+            a = _mm_and_si128(_mm_srli_si128(x, 9), mask);
+        }
+    }
+    return k;
+}
+
+static int stbi__unfilter_avg_sse2(stbi_uc* cur, const stbi_uc* prior, const stbi_uc* raw, int nk, int bpp)
+{
+    // floor((a + b) / 2) is the rounding-up average minus the dropped low bit
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i a = _mm_cvtsi32_si128(stbi__load_pixel(cur - bpp, bpp));
+    int k = 0;
+    for (; k + 4 <= nk; k += bpp) {
+        __m128i b = _mm_cvtsi32_si128(stbi__load32(prior + k));
+        __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        int v;
+        a = _mm_add_epi8(_mm_cvtsi32_si128(stbi__load32(raw + k)), avg);
+        v = _mm_cvtsi128_si32(a);
+        memcpy(cur + k, &v, 4); // for 3 bytes per pixel the 4th byte is rewritten by the next pixel
+    }
+    return k;
+}
+
+// Paeth predictor in 16-bit lanes: pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|,
+// then a if pa is smallest, else b if pb is, else c, matching stbi__paeth's ties
+#define STBI__PAETH_KERNEL(name, target, ABS)                                                        \
+target static int name(stbi_uc* cur, const stbi_uc* prior, const stbi_uc* raw, int nk, int bpp)      \
+{                                                                                                    \
+    const __m128i zero = _mm_setzero_si128();                                                        \
+    __m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(stbi__load_pixel(cur - bpp, bpp)), zero);       \
+    __m128i c = _mm_unpacklo_epi8(_mm_cvtsi32_si128(stbi__load_pixel(prior - bpp, bpp)), zero);     \
+    int k = 0;                                                                                       \
+    for (; k + 4 <= nk; k += bpp) {                                                                  \
+        __m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(stbi__load32(prior + k)), zero);            \
+        __m128i bc = _mm_sub_epi16(b, c), ac = _mm_sub_epi16(a, c);                                  \
+        __m128i pa = ABS(bc), pb = ABS(ac), pc = ABS(_mm_add_epi16(bc, ac));                         \
+        __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));                                 \
+        __m128i usePb = _mm_cmpeq_epi16(pb, smallest), usePa = _mm_cmpeq_epi16(pa, smallest);        \
+        __m128i nearest = _mm_or_si128(_mm_and_si128(usePb, b), _mm_andnot_si128(usePb, c));         \
+        __m128i x;                                                                                   \
+        int v;                                                                                       \
+        nearest = _mm_or_si128(_mm_and_si128(usePa, a), _mm_andnot_si128(usePa, nearest));           \
+        x = _mm_add_epi8(_mm_cvtsi32_si128(stbi__load32(raw + k)), _mm_packus_epi16(nearest, nearest)); \
+        v = _mm_cvtsi128_si32(x);                                                                    \
+        memcpy(cur + k, &v, 4);                                                                      \
+        a = _mm_unpacklo_epi8(x, zero);                                                              \
+        c = b;                                                                                       \
+    }                                                                                                \
+    return k;                                                                                        \
+}
+
+static __m128i stbi__abs_epi16_sse2(__m128i x)
+{
+    return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+STBI__PAETH_KERNEL(stbi__unfilter_paeth_sse2, , stbi__abs_epi16_sse2)
+STBI__PAETH_KERNEL(stbi__unfilter_paeth_ssse3, STBI__TARGET_SSSE3, _mm_abs_epi16)
+#undef STBI__PAETH_KERNEL
+
+// bytes of the row already unfiltered, 0 if no kernel fits this filter and pixel size
+static int stbi__unfilter_simd(int filter, stbi_uc* cur, const stbi_uc* prior, const stbi_uc* raw, int nk, int bpp)
+{
+    int level = stbi_simd_level();
+    if (level == STBI_SIMD_NONE) return 0;
+    switch (filter) {
+    case STBI__F_up:
+        return level >= STBI_SIMD_AVX2 ? stbi__unfilter_up_avx2(cur, prior, raw, nk) : stbi__unfilter_up_sse2(cur, prior, raw, nk);
+    case STBI__F_sub:
+        return bpp == 3 || bpp == 4 ? stbi__unfilter_sub_sse2(cur, raw, nk, bpp) : 0;
+    case STBI__F_avg:
+        return bpp == 3 || bpp == 4 ? stbi__unfilter_avg_sse2(cur, prior, raw, nk, bpp) : 0;
+    case STBI__F_paeth:
+        if (bpp != 3 && bpp != 4) return 0;
+        return level >= STBI_SIMD_SSSE3 ? stbi__unfilter_paeth_ssse3(cur, prior, raw, nk, bpp) : stbi__unfilter_paeth_sse2(cur, prior, raw, nk, bpp);
+    }
+    return 0;
+}
+#endif // STBI_SSE2
+
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // create the png data from post-deflated data
@@ -4772,9 +6059,13 @@ static int stbi__create_png_image_raw(stbi__png* a, stbi_uc* raw, stbi__uint32 r
         // this is a little gross, so that we don't switch per-pixel or per-component
         if (depth < 8 || img_n == out_n) {
             int nk = (width - 1) * filter_bytes;
+            int done = 0; // bytes a SIMD kernel has already unfiltered
+#ifdef STBI_SSE2
+            done = stbi__unfilter_simd(filter, cur, prior, raw, nk, filter_bytes);
+#endif
 #define STBI__CASE(f) \
              case f:     \
-                for (k=0; k < nk; ++k)
+                for (k=done; k < nk; ++k)
             switch (filter) {
                 // "none" filter turns into a memcpy here; make that explicit.
             case STBI__F_none:         memcpy(cur, raw, nk); break;
@@ -0,0 +1,200 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <glad/glad.h>
+
+#include "stb_image.h"
+#include "texture_streamer.h"
+#include "cooked_texture.h"
+#include "gl_state.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Packs material images into GL_TEXTURE_2D_ARRAY textures, one array per
+// (width, height, channel count), so objects whose maps share an array differ
+// only by layer index and can be drawn without rebinding textures. add() reads
+// just the image header to place the file; build() allocates every array once
+// the layer counts are known, fills it grey and hands each layer to the
+// TextureStreamer, which decodes and uploads it in the background. A file with a
+// cooked .ctex beside it is grouped by the cooked format instead and copied into
+// its layer during build(), mips included, without decoding.
+class TextureArrays
+{
+public:
+	struct Slot
+	{
+		int array = -1;														// index into the manager's arrays, -1 if the file is unreadable
+		int layer = -1;
+	};
+
+	// places a file, returning the same slot for a file added twice
+	// ------------------------------------------------------------------------
+	Slot add(const char* filename)
+	{
+		for (size_t i = 0; i < layers.size(); ++i)
+			if (layers[i].file == filename)
+				return layers[i].slot;
+
+		Layer entry;
+		entry.file = filename;
+		int width, height, components;
+		GLenum internalFormat;
+		std::string cookedPath = CookedTexture::pathFor(filename);
+		CookedTexture cooked;
+		if (cooked.open(cookedPath.c_str()) && cooked.header().levels == levelsFor(cooked.header().width, cooked.header().height))
+		{
+			entry.cooked = cookedPath;
+			width = cooked.header().width;
+			height = cooked.header().height;
+			components = cooked.compressed() ? 0 : componentsOf(cooked.header().format);
+			internalFormat = cooked.header().internalFormat;
+		}
+		else if (stbi_info(filename, &width, &height, &components))
+			internalFormat = sizedFormatOf(components);
+		else
+		{
+			std::cout << "Texture failed to load at path: " << filename << std::endl;
+			layers.push_back(entry);
+			return entry.slot;
+		}
+
+		size_t index = 0;
+		while (index < arrays.size() && !(arrays[index].width == width && arrays[index].height == height
+			&& arrays[index].internalFormat == internalFormat))
+			++index;
+		if (index == arrays.size())
+		{
+			Array array;
+			array.width = width;
+			array.height = height;
+			array.components = components;
+			array.internalFormat = internalFormat;
+			arrays.push_back(array);
+		}
+		entry.slot.array = (int)index;
+		entry.slot.layer = arrays[index].layers++;
+		if (!entry.cooked.empty())
+			arrays[index].cookedLayers++;
+		layers.push_back(entry);
+		return entry.slot;
+	}
+
+	// allocates the arrays, copies cooked layers in and queues every other
+	// layer's decode; add() after this is not supported
+	// ------------------------------------------------------------------------
+	void build(TextureStreamer& streamer)
+	{
+		for (size_t i = 0; i < arrays.size(); ++i)
+		{
+			Array& array = arrays[i];
+			glGenTextures(1, &array.texture);
+			GLState::instance().bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, array.texture);
+			glTexStorage3D(GL_TEXTURE_2D_ARRAY, levelsFor(array.width, array.height), array.internalFormat, array.width, array.height, array.layers);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+			// grey placeholder in every layer until the streamer delivers the image;
+			// not needed when every layer is cooked and written below, which is
+			// always the case for block-compressed arrays
+			if (array.cookedLayers == array.layers)
+				continue;
+			std::vector<unsigned char> grey((size_t)array.width * array.height * array.layers * array.components, 128);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			for (unsigned int level = 0; level < levelsFor(array.width, array.height); ++level)
+			{
+				int width = array.width >> level > 0 ? array.width >> level : 1;
+				int height = array.height >> level > 0 ? array.height >> level : 1;
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, width, height, array.layers, formatOf(array.components), GL_UNSIGNED_BYTE, grey.data());
+			}
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		}
+
+		for (size_t i = 0; i < layers.size(); ++i)
+		{
+			const Slot& slot = layers[i].slot;
+			if (slot.array < 0)
+				continue;
+			CookedTexture cooked;
+			if (!layers[i].cooked.empty() && cooked.open(layers[i].cooked.c_str()))
+			{
+				cooked.uploadLayer(arrays[slot.array].texture, slot.layer);
+				cookedLayers++;
+			}
+			else
+				streamer.requestLayer(layers[i].file.c_str(), arrays[slot.array].texture, slot.layer);
+		}
+	}
+
+	void destroy()
+	{
+		for (size_t i = 0; i < arrays.size(); ++i)
+			glDeleteTextures(1, &arrays[i].texture);
+		GLState::instance().invalidate();									// deleted names may still be shadowed as bound
+		arrays.clear();
+		layers.clear();
+		cookedLayers = 0;
+	}
+
+	// GL texture of a slot's array, 0 before build() or for unreadable files
+	GLuint texture(const Slot& slot) const { return slot.array >= 0 ? arrays[slot.array].texture : 0; }
+
+	void print(std::ostream& out) const
+	{
+		out << "Texture arrays: " << layers.size() << " images (" << cookedLayers << " cooked) in " << arrays.size() << " arrays";
+		for (size_t i = 0; i < arrays.size(); ++i)
+			out << (i ? ", " : " (") << arrays[i].width << "x" << arrays[i].height << "x"
+				<< (arrays[i].components ? std::to_string(arrays[i].components) : std::string("compressed"))
+				<< " with " << arrays[i].layers << (arrays[i].layers == 1 ? " layer" : " layers") << (i + 1 == arrays.size() ? ")" : "");
+		out << std::endl;
+	}
+
+	static GLenum formatOf(int components)
+	{
+		return components == 1 ? GL_RED : components == 2 ? GL_RG : components == 3 ? GL_RGB : GL_RGBA;
+	}
+
+	static int componentsOf(GLenum format)
+	{
+		return format == GL_RED ? 1 : format == GL_RG ? 2 : format == GL_RGB ? 3 : 4;
+	}
+
+	static GLenum sizedFormatOf(int components)
+	{
+		return components == 1 ? GL_R8 : components == 2 ? GL_RG8 : components == 3 ? GL_RGB8 : GL_RGBA8;
+	}
+
+	// length of the full mip chain
+	static unsigned int levelsFor(int width, int height)
+	{
+		unsigned int levels = 1;
+		while ((width >> levels) > 0 || (height >> levels) > 0)
+			++levels;
+		return levels;
+	}
+
+private:
+	struct Array
+	{
+		int width = 0, height = 0, components = 0;						// components is 0 for block-compressed arrays
+		GLenum internalFormat = 0;
+		int layers = 0;
+		int cookedLayers = 0;
+		GLuint texture = 0;
+	};
+
+	struct Layer
+	{
+		std::string file;
+		std::string cooked;													// .ctex path, empty to decode file
+		Slot slot;
+	};
+
+	std::vector<Array> arrays;
+	std::vector<Layer> layers;
+	int cookedLayers = 0;
+};
+#endif
@@ -0,0 +1,406 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+
+#include "stb_image.h"
+#include "job_system.h"
+#include "mip_generator.h"
+#include "profiler.h"
+#include "gl_state.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Loads texture array layers without stalling the frame. requestLayer() queues
+// a file for one layer of an already allocated GL_TEXTURE_2D_ARRAY; the file is
+// read into a pooled buffer and decoded by stb_image on a job system worker.
+// update(), called once per frame on the GL thread, copies finished images into
+// a pixel buffer object and writes the layer from it, stopping once the frame's
+// time budget is spent. The layer keeps its placeholder until then, so materials
+// pick up the real image without being told. The mip chain is built by
+// MipGenerator on the worker too, so update() only copies levels. With a
+// preview scale set, a JPEG is first decoded at that fraction of its size, which
+// stb_image does by shortening the IDCT. The small image and its mips go into
+// the layer's lower levels, the ones of matching size, and the levels above are
+// stretched from it on the GPU, so the layer shows the preview at every
+// distance until the full image replaces it.
+class TextureStreamer
+{
+public:
+	static const int PBO_COUNT = 2;
+
+	struct Stats
+	{
+		unsigned int requested = 0;
+		unsigned int resident = 0;
+		unsigned int failed = 0;
+		unsigned long long uploadedBytes = 0;
+		unsigned long long lastFrameBytes = 0;								// bytes uploaded by the most recent update()
+		unsigned long long peakFrameBytes = 0;
+		double maxLatencyMilliseconds = 0.0;								// requestLayer() to resident, worst case
+		unsigned int previews = 0;
+		double maxPreviewLatencyMilliseconds = 0.0;							// requestLayer() to preview uploaded, worst case
+		unsigned int deferred = 0;											// uploads put off to the next frame: no PBO free or mappable
+	};
+
+	// needs a current GL context; previewScale 2, 4 or 8 turns on previews
+	// ------------------------------------------------------------------------
+	void init(double budgetMilliseconds, const MipGenerator::Options& mipOptions = MipGenerator::Options(), int previewScale = 0)
+	{
+		budget = budgetMilliseconds;
+		mips = mipOptions;
+		preview = previewScale;
+		glGenBuffers(PBO_COUNT, pbos);
+		glGenFramebuffers(2, framebuffers);
+		for (int i = 0; i < PBO_COUNT; ++i)
+		{
+			pboSizes[i] = 0;
+			pboFences[i] = 0;
+		}
+		latencyZone = Profiler::instance().zone("Texture Latency");
+	}
+
+	// waits for outstanding decodes and drops anything not yet uploaded
+	// ------------------------------------------------------------------------
+	void destroy()
+	{
+		JobSystem::instance().wait(decodes);
+		for (size_t i = 0; i < requests.size(); ++i)
+		{
+			stbi_image_free(requests[i]->image.pixels);
+			stbi_image_free(requests[i]->preview.pixels);
+		}
+		requests.clear();
+		ready.clear();
+		for (int i = 0; i < PBO_COUNT; ++i)
+			if (pboFences[i])
+				glDeleteSync(pboFences[i]);
+		glDeleteBuffers(PBO_COUNT, pbos);
+		glDeleteFramebuffers(2, framebuffers);
+	}
+
+	// decodes filename into layer of array, whose storage must match the image's
+	// size and channel count; the layer keeps its current contents until then
+	// ------------------------------------------------------------------------
+	void requestLayer(const char* filename, GLuint array, int layer)
+	{
+		std::unique_ptr<Request> pending(new Request());
+		pending->owner = this;
+		pending->file = filename;
+		pending->texture = array;
+		pending->layer = layer;
+		pending->start = std::chrono::steady_clock::now();
+		pending->image.request = pending.get();
+		pending->preview.request = pending.get();
+		Request* job = pending.get();
+		requests.push_back(std::move(pending));
+		stats.requested++;
+
+		JobSystem::instance().run(decode, job, 0, 0, &decodes);
+	}
+
+	// uploads decoded images until the frame's budget is used; at least one per
+	// call so a texture larger than the budget still gets through, unless every
+	// PBO is still being read by the GPU, in which case the rest waits a frame
+	// ------------------------------------------------------------------------
+	void update()
+	{
+		PROFILE_ZONE("Texture Upload");
+		stats.lastFrameBytes = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (;;)
+		{
+			Image* next = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(readyMutex);
+				if (ready.empty())
+					break;
+				next = ready.front();
+				ready.erase(ready.begin());
+			}
+			if (!upload(*next))
+			{
+				std::lock_guard<std::mutex> lock(readyMutex);
+				ready.insert(ready.begin(), next);
+				stats.deferred++;
+				break;
+			}
+			if (next == &next->request->image)
+				remove(next->request);
+			else
+			{
+				stbi_image_free(next->pixels);
+				next->pixels = nullptr;
+			}
+			if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budget)
+				break;
+		}
+		if (stats.lastFrameBytes > stats.peakFrameBytes)
+			stats.peakFrameBytes = stats.lastFrameBytes;
+	}
+
+	// true while any requested texture is still showing its placeholder
+	bool busy() const { return !requests.empty(); }
+
+	const Stats& getStats() const { return stats; }
+
+private:
+	struct Request;
+
+	struct Image
+	{
+		Request* request;
+		unsigned char* pixels = nullptr;										// stb_image allocation, null if decoding failed
+		int width = 0, height = 0, components = 0;
+		int level = 0;														// array level the image's base goes to
+		std::vector<MipGenerator::Level> mips;								// levels 1 and below
+	};
+
+	struct Request
+	{
+		TextureStreamer* owner;
+		std::string file;
+		GLuint texture;														// the GL_TEXTURE_2D_ARRAY
+		int layer;
+		int width = 0, height = 0;											// the layer's size, known once a preview is decoded
+		std::chrono::steady_clock::time_point start;
+		Image image;
+		Image preview;														// only used with a preview scale
+	};
+
+	// runs on a worker
+	static void decode(void* data, int, int)
+	{
+		Request& request = *(Request*)data;
+		TextureStreamer& streamer = *request.owner;
+
+		std::vector<unsigned char> bytes = streamer.acquireBuffer();
+		std::ifstream file(request.file, std::ios::binary | std::ios::ate);
+		if (file)
+		{
+			bytes.resize((size_t)file.tellg());
+			file.seekg(0);
+			file.read((char*)bytes.data(), bytes.size());
+
+			// only JPEGs decode faster at a reduced size; anything else would just be decoded twice
+			bool jpeg = bytes.size() > 2 && bytes[0] == 0xFF && bytes[1] == 0xD8;
+			int components;
+			if (streamer.preview > 1 && jpeg && stbi_info_from_memory(bytes.data(), (int)bytes.size(), &request.width, &request.height, &components))
+			{
+				request.preview.level = streamer.preview == 8 ? 3 : streamer.preview == 4 ? 2 : 1;
+				streamer.decodeImage(request.preview, bytes, streamer.preview);
+				if (request.preview.pixels)
+				{
+					std::lock_guard<std::mutex> lock(streamer.readyMutex);
+					streamer.ready.push_back(&request.preview);
+				}
+			}
+			streamer.decodeImage(request.image, bytes, 1);
+		}
+		streamer.releaseBuffer(std::move(bytes));
+
+		std::lock_guard<std::mutex> lock(streamer.readyMutex);
+		streamer.ready.push_back(&request.image);
+	}
+
+	// runs on a worker; scale 1 is the full image
+	void decodeImage(Image& image, const std::vector<unsigned char>& bytes, int scale) const
+	{
+		image.pixels = stbi_load_from_memory_scaled(bytes.data(), (int)bytes.size(), &image.width, &image.height, &image.components, 0, scale);
+		if (image.pixels)
+			image.mips = MipGenerator::build(image.pixels, image.width, image.height, image.components, mips);
+	}
+
+	// false if no PBO could take the image this frame; it is left untouched
+	bool upload(Image& image)
+	{
+		Request& request = *image.request;
+		bool isPreview = &image == &request.preview;
+		if (!image.pixels)
+		{
+			std::cout << "Texture failed to load at path: " << request.file << std::endl;
+			stats.failed++;
+			return true;
+		}
+
+		GLenum format = GL_RGBA;
+		if (image.components == 1)
+			format = GL_RED;
+		else if (image.components == 2)
+			format = GL_RG;
+		else if (image.components == 3)
+			format = GL_RGB;
+		GLsizeiptr baseSize = (GLsizeiptr)image.width * image.height * image.components;
+		GLsizeiptr size = baseSize;
+		for (size_t i = 0; i < image.mips.size(); ++i)
+			size += (GLsizeiptr)image.mips[i].pixels.size();
+
+		// PBOs rotate; take the first whose last upload the GPU has finished
+		// reading, without waiting for one
+		int slot = -1;
+		for (int i = 0; i < PBO_COUNT && slot < 0; ++i)
+		{
+			int candidate = (nextPbo + i) % PBO_COUNT;
+			if (pboFences[candidate])
+			{
+				if (glClientWaitSync(pboFences[candidate], GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+					continue;
+				glDeleteSync(pboFences[candidate]);
+				pboFences[candidate] = 0;
+			}
+			slot = candidate;
+		}
+		if (slot < 0)
+			return false;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[slot]);
+		if (size > pboSizes[slot])
+		{
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+			pboSizes[slot] = size;
+		}
+		unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		if (!mapped)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			return false;
+		}
+		nextPbo = (slot + 1) % PBO_COUNT;
+		memcpy(mapped, image.pixels, (size_t)baseSize);
+		GLintptr offset = baseSize;
+		for (size_t i = 0; i < image.mips.size(); ++i)
+		{
+			memcpy(mapped + offset, image.mips[i].pixels.data(), image.mips[i].pixels.size());
+			offset += (GLintptr)image.mips[i].pixels.size();
+		}
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		// levels are tightly packed; odd widths of 1 to 3 component images leave rows unaligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		GLState::instance().bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, request.texture);
+		offset = 0;
+		for (size_t level = 0; level <= image.mips.size(); ++level)
+		{
+			int width = level ? image.mips[level - 1].width : image.width;
+			int height = level ? image.mips[level - 1].height : image.height;
+			if (isPreview)
+			{
+				// a preview rounds its size up where the layer's levels round down, so it
+				// can be a texel wider or taller than the level it goes to; that edge is cut
+				int target = image.level + (int)level;
+				if ((request.width >> target) == 0 && (request.height >> target) == 0)
+					break;
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+				width = std::min(width, std::max(1, request.width >> target));
+				height = std::min(height, std::max(1, request.height >> target));
+			}
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, image.level + (GLint)level, 0, 0, request.layer, width, height, 1, format, GL_UNSIGNED_BYTE, (void*)offset);
+			offset += level ? (GLintptr)image.mips[level - 1].pixels.size() : baseSize;
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		pboFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		if (isPreview)
+			stretch(request, image.level);
+
+		double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - request.start).count();
+		stats.uploadedBytes += size;
+		stats.lastFrameBytes += size;
+		if (isPreview)
+		{
+			stats.previews++;
+			if (latency > stats.maxPreviewLatencyMilliseconds)
+				stats.maxPreviewLatencyMilliseconds = latency;
+			return true;
+		}
+		Profiler::instance().record(latencyZone, latency);
+		if (latency > stats.maxLatencyMilliseconds)
+			stats.maxLatencyMilliseconds = latency;
+		stats.resident++;
+		return true;
+	}
+
+	// fills the levels above level of the request's layer by scaling level up with
+	// linear filtering; a layer format that cannot be rendered to keeps its
+	// placeholder there
+	void stretch(const Request& request, int level)
+	{
+		GLint drawFramebuffer = 0, readFramebuffer = 0;
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+		glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, request.texture, level, request.layer);
+		int sourceWidth = std::max(1, request.width >> level), sourceHeight = std::max(1, request.height >> level);
+		for (int target = level - 1; target >= 0; --target)
+		{
+			glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, request.texture, target, request.layer);
+			if (glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE
+				|| glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+				break;
+			glBlitFramebuffer(0, 0, sourceWidth, sourceHeight, 0, 0, std::max(1, request.width >> target), std::max(1, request.height >> target),
+				GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		}
+		glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+		glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+	}
+
+	void remove(Request* request)
+	{
+		stbi_image_free(request->image.pixels);
+		for (size_t i = 0; i < requests.size(); ++i)
+		{
+			if (requests[i].get() == request)
+			{
+				requests.erase(requests.begin() + i);
+				return;
+			}
+		}
+	}
+
+	// file read buffers are recycled so steady streaming does not allocate
+	std::vector<unsigned char> acquireBuffer()
+	{
+		std::lock_guard<std::mutex> lock(poolMutex);
+		if (pool.empty())
+			return std::vector<unsigned char>();
+		std::vector<unsigned char> buffer = std::move(pool.back());
+		pool.pop_back();
+		return buffer;
+	}
+
+	void releaseBuffer(std::vector<unsigned char> buffer)
+	{
+		std::lock_guard<std::mutex> lock(poolMutex);
+		pool.push_back(std::move(buffer));
+	}
+
+	double budget = 2.0;
+	MipGenerator::Options mips;
+	int preview = 0;														// 0 or 1: no previews
+	GLuint pbos[PBO_COUNT] = {};
+	GLsizeiptr pboSizes[PBO_COUNT] = {};
+	GLsync pboFences[PBO_COUNT] = {};
+	GLuint framebuffers[2] = {};											// read and draw, for stretch()
+	int nextPbo = 0;
+	int latencyZone = 0;
+
+	std::vector<std::unique_ptr<Request>> requests;							// everything not yet resident, GL thread only
+	JobCounter decodes;
+	std::mutex readyMutex;
+	std::vector<Image*> ready;												// decoded, waiting for upload
+	std::mutex poolMutex;
+	std::vector<std::vector<unsigned char>> pool;
+	Stats stats;
+};
+#endif
@@ -0,0 +1,105 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// Binding points of the std140 blocks shared by every program; these must match
+// the layout(binding = N) qualifiers in the shaders. Binding 0 is the render
+// queue's per-draw "Draw" block.
+const GLuint CAMERA_BLOCK_BINDING = 1;
+const GLuint LIGHTS_BLOCK_BINDING = 2;
+
+// C++ mirrors of the GLSL blocks. std140 gives every vec3 a 16-byte slot unless a
+// scalar follows it, so the padding is spelled out: the structs have no implicit
+// padding and compare byte for byte.
+struct CameraBlock
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec3 viewPos;		float pad0;
+	glm::vec3 spotDirection;	float pad1;	// the flashlight points where the camera looks
+};
+
+struct DirLightStd140
+{
+	glm::vec3 direction;	float pad0;
+	glm::vec3 ambient;		float pad1;
+	glm::vec3 diffuse;		float pad2;
+	glm::vec3 specular;		float pad3;
+};
+
+struct PointLightStd140
+{
+	glm::vec3 position;
+	float constant;
+	float linear;
+	float quadratic;		float pad0[2];
+	glm::vec3 color;		float pad1;
+	glm::vec3 ambient;		float pad2;
+	glm::vec3 diffuse;		float pad3;
+	glm::vec3 specular;		float pad4;
+};
+
+// the direction lives in CameraBlock, so the lights block never changes
+struct SpotLightStd140
+{
+	glm::vec3 position;
+	float cutOff;
+	float outerCutOff;
+	float constant;
+	float linear;
+	float quadratic;
+	glm::vec3 ambient;		float pad0;
+	glm::vec3 diffuse;		float pad1;
+	glm::vec3 specular;		float pad2;
+};
+
+const int NR_POINT_LIGHTS = 2;
+
+struct LightsBlock
+{
+	DirLightStd140 dirLight;
+	PointLightStd140 pointLights[NR_POINT_LIGHTS];
+	SpotLightStd140 spotLight;
+};
+
+static_assert(offsetof(CameraBlock, viewPos) == 128 && offsetof(CameraBlock, spotDirection) == 144
+	&& sizeof(CameraBlock) == 160, "CameraBlock does not match std140");
+static_assert(sizeof(DirLightStd140) == 64, "DirLight does not match std140");
+static_assert(offsetof(PointLightStd140, color) == 32 && sizeof(PointLightStd140) == 96, "PointLight does not match std140");
+static_assert(offsetof(SpotLightStd140, cutOff) == 12 && offsetof(SpotLightStd140, ambient) == 32
+	&& sizeof(SpotLightStd140) == 80, "SpotLight does not match std140");
+static_assert(offsetof(LightsBlock, spotLight) == 256 && sizeof(LightsBlock) == 336, "LightsBlock does not match std140");
+
+// Uniform buffer for a block whose contents are fixed when it is created.
+// Anything that changes while frames are in flight goes through the frame
+// ring instead, so this buffer is never rewritten while the GPU reads it.
+template <typename Block>
+class UniformBuffer
+{
+public:
+	// needs a current GL context; the buffer stays bound at binding
+	// ------------------------------------------------------------------------
+	void create(GLuint binding, const Block& block)
+	{
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), &block, GL_STATIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+	}
+
+	void destroy()
+	{
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+
+private:
+	GLuint buffer = 0;
+};
+#endif